@@ -0,0 +1,233 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+//------------------------------------------------------------------------------
+// Board — Headless Minesweeper rules, no windowing or logging dependencies
+//------------------------------------------------------------------------------
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/// @file board.h
+/// @brief Board generation, reveals, chords and marks on boards of any size.
+
+//----------------------------------------
+// Cells
+//----------------------------------------
+
+/// @brief A cell packed into one byte.
+///
+/// The low nibble holds the number of neighboring bombs, the high nibble
+/// holds the state bits below.
+typedef uint8_t cell;
+
+#define CELL_COUNT      0x0F
+#define CELL_BOMB       0x10
+#define CELL_REVEALED   0x20
+#define CELL_FLAGGED    0x40
+#define CELL_QUESTION   0x80
+
+/// @brief Cells are stored row-major in one flat array.
+#define BOARD_CELL(b, x, y) ((b)->cells[(size_t)(y) * (b)->width + (x)])
+
+/// @brief Changed cells listed before the dirty set gives up and marks the
+/// whole board, a large flood fill is cheaper to redraw in full.
+#define BOARD_DIRTY_CAPACITY 1024
+
+/// @brief Level 0 summary chunks are 1 << BOARD_CHUNK_SHIFT cells a side,
+/// every level above doubles that.
+#define BOARD_CHUNK_SHIFT 3
+
+//----------------------------------------
+// Summaries
+//----------------------------------------
+
+/// @brief Counts over a square chunk of cells. Hidden cells are the cells
+/// of the chunk minus the revealed ones.
+typedef struct {
+    uint32_t revealed;
+    uint32_t flagged;
+} board_summary;
+
+/// @brief One level of chunks, from the board's corner.
+typedef struct {
+    int cols, rows;
+    board_summary *chunks;      // row-major
+    uint8_t *stale;             // above level 0, chunks to recount
+    uint32_t *stale_list;
+    size_t stale_count;
+} board_summary_level;
+
+//----------------------------------------
+// Board
+//----------------------------------------
+
+typedef enum {
+    BOARD_PLAYING,
+    BOARD_WON,
+    BOARD_LOST,
+} board_status;
+
+/// @brief A board and all of its cells in a single allocation.
+///
+/// Fields are readable by the caller, but only change them through the
+/// functions below so the counters stay in sync.
+typedef struct {
+    int width;
+    int height;
+    int num_bombs;
+
+    /* Bombs are placed on the first reveal, driven by the seed and the
+     * first revealed cell, so a board can be replayed */
+    uint64_t seed;
+    uint64_t rng[4];
+    bool generated;
+    board_status status;
+
+    // Live counters, kept up to date by every reveal and mark
+    size_t hidden_safe;     // Safe cells not yet revealed, 0 means won
+    int flags;
+    int questions;
+
+    // Scratch list of cell indices for flood fills, reused between reveals
+    uint32_t *work;
+    size_t work_capacity;
+
+    // Cells changed since the last board_clear_dirty, for redrawing
+    uint32_t *dirty;        // BOARD_DIRTY_CAPACITY indices, allocated on use
+    size_t dirty_count;
+    bool all_dirty;         // the list overflowed, or the board was reset
+
+    /* Chunk counts at every level until one chunk covers the board, NULL
+     * when they could not be allocated. Level 0 follows every change */
+    board_summary_level *levels;
+    int level_count;
+
+    cell cells[];
+} board;
+
+//----------------------------------------
+// Custom Allocators
+//----------------------------------------
+
+void *board_calloc(size_t count, size_t size);
+void *board_malloc(size_t size);
+void *board_realloc(void *ptr, size_t size);
+void board_free(void *ptr);
+
+//----------------------------------------
+// Lifecycle
+//----------------------------------------
+
+/// @brief Creates an empty board, ready for its first reveal.
+///
+/// At least one cell has to stay safe, and the board can hold at most
+/// UINT32_MAX cells.
+///
+/// @return The new board, or NULL on invalid arguments or out of memory.
+board *board_create(int width, int height, int num_bombs, uint64_t seed);
+
+/// @brief Frees the board and its scratch memory.
+void board_destroy(board *b);
+
+/// @brief Clears the board for a new game with the given seed.
+///
+/// Bombs are not placed until the first reveal, so this only clears memory.
+void board_reset(board *b, uint64_t seed);
+
+/// @brief Places the bombs, keeping the given cell clear.
+///
+/// The neighbors of the cell are kept clear too when the bomb count leaves
+/// room. Called by the first reveal, call it directly to generate early.
+/// Flags and question marks already on the board are kept.
+///
+/// @return false when out of memory, the board is left ungenerated.
+bool board_generate(board *b, int safe_x, int safe_y);
+
+//----------------------------------------
+// Moves
+//----------------------------------------
+
+/// @brief Reveals a cell, flood filling the blank area around it.
+///
+/// Revealing a bomb loses the game. Flagged and revealed cells are ignored.
+///
+/// @return Number of safe cells revealed.
+size_t board_reveal(board *b, int x, int y);
+
+/// @brief Reveals the hidden neighbors of a number whose flags are all placed.
+///
+/// All neighbors are revealed by one flood fill. Bombs under a wrong flag
+/// guess are revealed and lose the game.
+///
+/// @return Number of safe cells revealed.
+size_t board_chord(board *b, int x, int y);
+
+/// @brief Cycles the mark of a hidden cell: flag → question mark → blank.
+void board_flag(board *b, int x, int y);
+
+//----------------------------------------
+// Queries
+//----------------------------------------
+
+/// @brief Returns the cell at the given coordinates, 0 when out of bounds.
+cell board_get_cell(const board *b, int x, int y);
+
+/// @brief Returns whether the game is still on, won or lost.
+board_status board_get_status(const board *b);
+
+/// @brief Returns bombs minus flags placed, negative with too many flags.
+int board_bombs_left(const board *b);
+
+//----------------------------------------
+// Dirty Cells
+//----------------------------------------
+
+/// @brief Returns the cells changed since the last board_clear_dirty.
+///
+/// Reveals, marks and resets record their cells, callers add cells whose
+/// look changed for other reasons. Cells may be listed more than once.
+///
+/// @param[out] cells Indices y * width + x.
+/// @param[out] count Number of indices.
+/// @return false when the whole board has to be treated as changed.
+bool board_get_dirty(const board *b, const uint32_t **cells, size_t *count);
+
+/// @brief Forgets the changed cells, once they have been redrawn.
+void board_clear_dirty(board *b);
+
+/// @brief Records a cell as changed, ignored when out of bounds.
+void board_mark_dirty(board *b, int x, int y);
+
+/// @brief Records the whole board as changed.
+void board_mark_all_dirty(board *b);
+
+//----------------------------------------
+// Summaries
+//----------------------------------------
+
+/// @brief Returns the number of summary levels, 0 when there are none.
+int board_summary_levels(const board *b);
+
+/// @brief Returns the chunk counts of one level, for drawing the board
+/// without visiting every cell.
+///
+/// Level l chunks are 1 << (BOARD_CHUNK_SHIFT + l) cells a side, the last
+/// row and column are cut by the board edge. Level 0 is kept up to date by
+/// reveals and marks, the levels above recount only the chunks below them
+/// that changed, here.
+///
+/// @param[out] cols Chunks across.
+/// @param[out] rows Chunks down.
+/// @return The chunks row-major, NULL for a level out of range.
+const board_summary *board_get_summary(board *b, int level, int *cols, int *rows);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // BOARD_H
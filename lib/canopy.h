@@ -128,12 +128,63 @@ void canopy_swap_backbuffer(canopy_window* w, framebuffer* backbuffer);
 /// @}
 
 
+/// @name Damage Rectangles
+/// @brief Presenting only the parts of a frame that changed.
+/// @{
+///
+/// @brief Most rectangles kept after merging, more are joined into one.
+#define CANOPY_MAX_DAMAGE_RECTS 16
+
+/// @brief A region of the framebuffer, in pixels.
+typedef struct {
+    int x, y, width, height;
+} canopy_rect;
+
+/// @brief Copies the damaged regions of a backbuffer into the window's
+/// framebuffer and presents them.
+///
+/// The rectangles are clipped to the framebuffer and merged first, so
+/// overlapping and neighboring rectangles are handled once. Nothing is
+/// presented when no rectangle is left.
+///
+/// @param[in,out] w The target window.
+/// @param[in] src Backbuffer the size of the framebuffer, or NULL when the
+///                framebuffer already holds the new frame.
+/// @param[in] rects Damaged rectangles, may extend past the framebuffer.
+/// @param[in] count Number of rectangles.
+void canopy_present_damage(canopy_window* w, const framebuffer* src,
+                           const canopy_rect* rects, int count);
+
+/// @brief Clips rectangles to a width x height area and merges them.
+///
+/// Two rectangles are merged when their bounding box is no larger than the
+/// two areas together. Past max rectangles everything is joined into one.
+///
+/// @param[out] out Room for max merged rectangles.
+/// @return Number of rectangles written to out.
+int canopy_merge_rects(canopy_rect* out, int max, const canopy_rect* rects,
+                       int count, int width, int height);
+
+/// @brief Copies the given rectangles of src into dst, row by row.
+///
+/// The rectangles have to lie inside both framebuffers, as returned by
+/// canopy_merge_rects().
+void canopy_copy_rects(framebuffer* dst, const framebuffer* src,
+                       const canopy_rect* rects, int count);
+/// @}
+
+
 /// @name Event Handling
 /// @brief Supports polling and pushing input events.
 ///
 /// @{
-/// @brief Maximum number of simultaneous events stored in the internal event queue.
-#define CANOPY_MAX_EVENTS 64
+/// @brief Capacity of the internal event queue, a power of two.
+///
+/// Define it when building canopy to change it. Events pushed while the
+/// queue is full are dropped and counted.
+#ifndef CANOPY_MAX_EVENTS
+#define CANOPY_MAX_EVENTS 256
+#endif
 
 /// @brief Type of high-level events.
 typedef enum {
@@ -183,6 +234,7 @@ typedef struct {
 /// @brief Generic event union.
 typedef struct {
     canopy_event_type type;
+    uint64_t timestamp_ns;  ///< canopy_get_time_ns() when pushed, unless set.
     union {
         canopy_mouse_event mouse;
         canopy_key_event key;
@@ -190,6 +242,10 @@ typedef struct {
 } canopy_event;
 
 /// @brief Poll the next event, if available.
+///
+/// Consecutive mouse moves, or drags with the same button, come out as one
+/// event at the last position, carrying the timestamp of the first.
+///
 /// @param[out] out_event Pointer to a canopy_event struct to fill.
 /// @return true if an event was available and written to out_event, false otherwise.
 bool canopy_poll_event(canopy_event* out_event);
@@ -215,8 +271,42 @@ void canopy_wait_events(void);
 void canopy_wait_events_timeout(double timeout_seconds);
 
 /// @brief Manually push an event into the queue.
+///
+/// The queue is lock-free for one producer and one consumer, so events may
+/// be pushed from one thread other than the one polling. Follow up with
+/// canopy_post_empty_event() to wake a waiting consumer.
 void canopy_push_event(canopy_event event);
 
+/// @brief Counters of the event queue since the start of the program.
+typedef struct {
+    uint64_t pushed;            ///< Events accepted into the queue.
+    uint64_t dropped;           ///< Events lost to a full queue.
+    uint64_t coalesced;         ///< Moves and drags folded into a later one.
+    uint64_t polled;            ///< Events handed out by canopy_poll_event().
+    uint32_t high_water;        ///< Most events queued at once.
+    uint64_t total_latency_ns;  ///< Sum of push to poll times of polled events.
+    uint64_t max_latency_ns;    ///< Longest push to poll time.
+} canopy_event_stats;
+
+/// @brief Reads the event queue counters.
+///
+/// The producer side counters are updated atomically, but the snapshot as
+/// a whole is not taken at one instant.
+void canopy_get_event_stats(canopy_event_stats* out_stats);
+
+/// @brief Feed input events from a script file.
+///
+/// Only the headless backend runs scripts, the others return false.
+///
+/// Commands become events through canopy_push_event() as their time comes
+/// up, and the window closes at the end of the script. The headless window
+/// also loads the file named by the CANOPY_SCRIPT environment variable.
+/// See src/canopy_headless.c for the script format.
+///
+/// @param filepath Path to the script.
+/// @return true if the script was opened.
+bool canopy_load_script(const char *filepath);
+
 
 
 
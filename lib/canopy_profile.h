@@ -0,0 +1,97 @@
+#ifndef CANOPY_PROFILE_H
+#define CANOPY_PROFILE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "canopy_time.h"
+
+/// @file canopy_profile.h
+/// @brief Named timing scopes with per-phase histograms.
+///
+/// Build with CANOPY_PROFILE defined to turn the scopes on. Without it the
+/// scope macros expand to nothing and the functions below do nothing.
+/// Scopes are meant for one thread, the one running the main loop.
+
+
+//----------------------------------------
+// Configuration
+//----------------------------------------
+
+/// @brief Most distinct phase names, later names are not recorded.
+#define CANOPY_PROFILE_MAX_PHASES 32
+
+/// @brief Most recent samples kept in order for the trace, a power of two.
+#ifndef CANOPY_PROFILE_RING_SIZE
+#define CANOPY_PROFILE_RING_SIZE 16384
+#endif
+
+
+//----------------------------------------
+// Scopes
+//----------------------------------------
+
+/// @brief Starts timing a phase. The name is a plain identifier, and has
+/// to be ended in the same block.
+///
+/// @code
+///     CANOPY_PROFILE_BEGIN(draw_canvas);
+///     draw_canvas(...);
+///     CANOPY_PROFILE_END(draw_canvas);
+/// @endcode
+#if defined(CANOPY_PROFILE)
+#define CANOPY_PROFILE_BEGIN(name) \
+    uint64_t canopy__profile_##name = canopy_get_time_ns()
+#define CANOPY_PROFILE_END(name) \
+    canopy_profile_record(#name, canopy__profile_##name, canopy_get_time_ns())
+#define CANOPY_PROFILE_INSTANT(name, time_ns) \
+    canopy_profile_instant(#name, (time_ns))
+#else
+#define CANOPY_PROFILE_BEGIN(name)          ((void)0)
+#define CANOPY_PROFILE_END(name)            ((void)0)
+#define CANOPY_PROFILE_INSTANT(name, time_ns) ((void)0)
+#endif
+
+/// @brief Records one run of a phase.
+///
+/// Called by CANOPY_PROFILE_END(). The name is kept, so it has to outlive
+/// the profile, string literals do.
+void canopy_profile_record(const char *name, uint64_t start_ns, uint64_t end_ns);
+
+/// @brief Marks a moment, such as the arrival of an input event.
+///
+/// Instants only show up in the trace, not in the phase report.
+void canopy_profile_instant(const char *name, uint64_t time_ns);
+
+
+//----------------------------------------
+// Reports
+//----------------------------------------
+
+/// @brief Writes count, min, avg, p50, p99 and max of every phase.
+///
+/// Percentiles come from log-linear histograms and are accurate to
+/// about 12%.
+///
+/// @param out Stream to write to, such as stdout.
+void canopy_profile_dump(FILE *out);
+
+/// @brief Same as canopy_profile_dump(), into a new file.
+///
+/// @return false if the file could not be written.
+bool canopy_profile_dump_file(const char *path);
+
+/// @brief Writes the kept samples as a Chrome trace-event JSON file.
+///
+/// Phases become complete events and instants become instant events, on
+/// one track. Load the file in chrome://tracing or ui.perfetto.dev. Only
+/// the last CANOPY_PROFILE_RING_SIZE samples are kept.
+///
+/// @return false if the file could not be written or profiling is off.
+bool canopy_profile_write_trace(const char *path);
+
+/// @brief Forgets all samples and phases.
+void canopy_profile_reset(void);
+
+#endif // CANOPY_PROFILE_H
@@ -16,6 +16,7 @@
 
 #include "input.h"        ///< Input keys and mouse buttons
 #include "canopy_time.h"  ///< Timing utilities
+#include "canopy_profile.h" ///< Timing scopes, on with CANOPY_PROFILE
 
 //------------------------------------------------------------------------------
 // Memory Allocation
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdbool.h>
 
 /* -------------------- Picasso Objects -------------------- */
 typedef struct {
@@ -257,9 +258,17 @@ int picasso_save_to_ppm(PPM *image, const char *file_path);
 
 /* -------------------- Backbuffer Section -------------------- */
 
+#define PICASSO_MAX_DAMAGE 64
+
+/* Every draw call records the region it touched, so only those regions
+ * have to be presented. Past PICASSO_MAX_DAMAGE regions they are joined
+ * into their bounding box */
 typedef struct {
     uint32_t* pixels;
     uint32_t width, height, pitch;
+
+    picasso_rect damage[PICASSO_MAX_DAMAGE]; // clipped, drawn since picasso_clear_damage
+    int damage_count;
 } picasso_backbuffer;
 
 picasso_backbuffer* picasso_create_backbuffer(int width, int height);
@@ -270,6 +279,95 @@ void picasso_blit_bitmap(picasso_backbuffer *dst, picasso_image *src, int offset
 void picasso_blit_rect(picasso_backbuffer *dst, picasso_image *src, picasso_rect src_rect, picasso_rect dst_rect);
 void* picasso_backbuffer_pixels(picasso_backbuffer *bf);
 
+int picasso_get_damage(const picasso_backbuffer *bf, const picasso_rect **rects);
+void picasso_clear_damage(picasso_backbuffer *bf);
+void picasso_add_damage(picasso_backbuffer *bf, picasso_rect r); // for writes through the pixels
+
+/* -------------------- Layer Section -------------------- */
+
+/* A layer is a backbuffer holding static content, rasterized once with the
+ * usual draw calls. Drawing it copies whole rows into the destination, so
+ * a frame can start from it instead of clearing and redrawing. Regions the
+ * frame paints over completely can be skipped */
+picasso_backbuffer *picasso_create_layer(int width, int height);
+void picasso_draw_layer(picasso_backbuffer *dst, const picasso_backbuffer *layer,
+                        const picasso_rect *overdrawn);
+void picasso_draw_layer_rect(picasso_backbuffer *dst, const picasso_backbuffer *layer,
+                             picasso_rect r);
+
+/* -------------------- Blending Section -------------------- */
+
+/* Blend count pixels of src over dst, both in the backbuffer layout. The
+ * kernels use SSE2 or AVX2 when the build targets them and give the same
+ * results as the scalar fallback */
+void picasso_blend_span(uint32_t *dst, const uint32_t *src, int count);
+void picasso_blend_span_premultiplied(uint32_t *dst, const uint32_t *src, int count);
+void picasso_blend_span_color(uint32_t *dst, uint32_t src, int count);
+
+/* -------------------- Texture Section -------------------- */
+
+/* An image converted once at load time into the backbuffer pixel layout,
+ * with premultiplied alpha, so blits copy or blend words directly.
+ * Translucent pixels round differently from picasso_blit_rect and can be
+ * off by 1 per channel */
+typedef struct {
+    int width;
+    int height;
+    int pitch;          // pixels per row, like the backbuffer
+    bool opaque;        // every pixel has alpha 255, blits are plain copies
+    uint32_t *pixels;
+} picasso_texture;
+
+picasso_texture *picasso_texture_from_image(const picasso_image *img);
+picasso_texture *picasso_load_texture(const char *filename);
+void picasso_free_texture(picasso_texture *tex);
+void picasso_blit_texture(picasso_backbuffer *dst, const picasso_texture *src,
+                          picasso_rect src_rect, picasso_rect dst_rect);
+
+/* -------------------- Sprite Batch Section -------------------- */
+
+/* Many same sized sprites out of one atlas, scaled alike. Draws the same
+ * pixels as a picasso_blit_texture per sprite in order, but the scale is
+ * set up once, and neighbors on one row are drawn a scanline across the
+ * whole run at a time. Sizes are positive */
+typedef struct {
+    int src_x, src_y;   // corner in the atlas
+    int dst_x, dst_y;   // corner in the backbuffer
+} picasso_sprite;
+
+typedef struct {
+    const picasso_texture *atlas;
+    int src_width, src_height;
+    int dst_width, dst_height;
+    int offset_x, offset_y;         // added to every destination
+    const picasso_sprite *sprites;
+    int count;
+} picasso_sprite_batch;
+
+void picasso_blit_batch(picasso_backbuffer *dst, const picasso_sprite_batch *batch);
+
+/* -------------------- Sprite Cache Section -------------------- */
+
+/* Sprites of an atlas scaled once to the size they are drawn at, side by
+ * side in one texture, sprite i at (i * width, 0). Batches out of the cache
+ * have the same source and destination size, so every row is a plain copy,
+ * and draw the same pixels as scaling from the atlas */
+typedef struct {
+    picasso_texture *texture;
+    const picasso_texture *atlas;   // what the texture was built from
+    int width, height;
+    int count;
+} picasso_sprite_cache;
+
+/* Builds the cache when the atlas, the sprite size or the sprite count
+ * differ from the last build, otherwise does nothing. Changing sources
+ * alone does not rebuild, free the cache first. Returns false on invalid
+ * arguments or out of memory, the cache is left empty */
+bool picasso_update_sprite_cache(picasso_sprite_cache *cache, const picasso_texture *atlas,
+                                 const picasso_rect *sources, int count,
+                                 int width, int height);
+void picasso_free_sprite_cache(picasso_sprite_cache *cache);
+
 /* -------------------- Graphical Raster Section -------------------- */
 
 typedef struct {
@@ -284,4 +382,73 @@ void picasso_draw_line(picasso_backbuffer *bf, int x0, int y0, int x1, int y1, c
 void picasso_draw_circle(picasso_backbuffer *bf, int x0, int y0, int radius,int thickness, color c);
 void picasso_fill_circle(picasso_backbuffer *bf, int x0, int y0, int radius, color c);
 
+/* -------------------- Command Section -------------------- */
+
+/* Draw calls recorded during a frame and run later by a rasterizer. The
+ * commands keep pointers to their textures and layers, which have to stay
+ * alive until the list is rasterized */
+typedef enum {
+    PICASSO_CMD_CLEAR,
+    PICASSO_CMD_FILL_RECT,
+    PICASSO_CMD_DRAW_RECT,
+    PICASSO_CMD_FILL_CIRCLE,
+    PICASSO_CMD_DRAW_CIRCLE,
+    PICASSO_CMD_BLIT_TEXTURE,
+    PICASSO_CMD_DRAW_LAYER,
+    PICASSO_CMD_BLIT_BATCH,
+} picasso_command_type;
+
+typedef struct {
+    picasso_command_type type;
+    union {
+        struct { picasso_rect r; int thickness; color c; } rect;
+        struct { int x0, y0, radius, thickness; color c; } circle;
+        struct { const picasso_texture *tex; picasso_rect src, dst; } blit;
+        struct { const picasso_backbuffer *layer; picasso_rect r; } layer;
+        struct { picasso_sprite_batch batch; int first; } batch; // sprites live in the list
+    };
+} picasso_command;
+
+typedef struct {
+    picasso_command *commands;
+    int count;
+    int capacity;
+
+    picasso_sprite *sprites;    // copies of the sprites of batch commands
+    int sprite_count;
+    int sprite_capacity;
+} picasso_command_list;
+
+picasso_command_list *picasso_create_command_list(void);
+void picasso_destroy_command_list(picasso_command_list *list);
+void picasso_reset_command_list(picasso_command_list *list);
+
+void picasso_cmd_clear(picasso_command_list *list);
+void picasso_cmd_fill_rect(picasso_command_list *list, picasso_rect r, color c);
+void picasso_cmd_draw_rect(picasso_command_list *list, picasso_rect r, int thickness, color c);
+void picasso_cmd_fill_circle(picasso_command_list *list, int x0, int y0, int radius, color c);
+void picasso_cmd_draw_circle(picasso_command_list *list, int x0, int y0, int radius, int thickness, color c);
+void picasso_cmd_blit_texture(picasso_command_list *list, const picasso_texture *src,
+                              picasso_rect src_rect, picasso_rect dst_rect);
+void picasso_cmd_draw_layer_rect(picasso_command_list *list, const picasso_backbuffer *layer,
+                                 picasso_rect r);
+void picasso_cmd_blit_batch(picasso_command_list *list, const picasso_sprite_batch *batch);
+
+/* -------------------- Rasterizer Section -------------------- */
+
+/* A fixed pool of threads that runs a command list. Every thread owns a
+ * horizontal band of the backbuffer and runs all commands clipped to it,
+ * so threads never touch the same pixels and the result is the same as
+ * drawing the commands in order on one thread. Small lists are drawn on
+ * the calling thread, where waking the pool costs more than it saves */
+#define PICASSO_RASTER_MAX_THREADS 16
+#define PICASSO_RASTER_MIN_PIXELS  (64 * 1024) // covered pixels worth a wakeup
+
+typedef struct picasso_rasterizer picasso_rasterizer;
+
+picasso_rasterizer *picasso_create_rasterizer(int threads); // 0 for one per core
+void picasso_destroy_rasterizer(picasso_rasterizer *r);
+void picasso_rasterize(picasso_rasterizer *r, picasso_backbuffer *dst,
+                       const picasso_command_list *list);
+
 #endif // PICASSO_H
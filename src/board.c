@@ -0,0 +1,705 @@
+#include "board.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef CUSTOM_ALLOCATOR
+    #include <stdlib.h>
+#endif
+#include <string.h>
+
+#define BOARD_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define BOARD_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+void *board_calloc(size_t count, size_t size)
+{
+    return calloc(count, size);
+}
+void *board_malloc(size_t size)
+{
+    return malloc(size);
+}
+void *board_realloc(void *ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+void board_free(void *ptr)
+{
+    free(ptr);
+}
+
+//------------------------------------------------------------------------------
+// Neighbor Counts
+//------------------------------------------------------------------------------
+
+/* Sums the bomb bits of three rows column by column. Bombs are summed as
+ * CELL_BOMB (16) rather than 1, nine of them still fit in a byte */
+static void sum_bomb_columns(const cell *up, const cell *mid, const cell *down,
+                             uint8_t *out, int n)
+{
+    int x = 0;
+
+#if defined(__AVX2__)
+    const __m256i bomb256 = _mm256_set1_epi8(CELL_BOMB);
+    for (; x + 32 <= n; x += 32) {
+        __m256i u = _mm256_loadu_si256((const __m256i *)(up + x));
+        __m256i m = _mm256_loadu_si256((const __m256i *)(mid + x));
+        __m256i d = _mm256_loadu_si256((const __m256i *)(down + x));
+        __m256i sum = _mm256_add_epi8(_mm256_and_si256(u, bomb256),
+                                      _mm256_and_si256(m, bomb256));
+        sum = _mm256_add_epi8(sum, _mm256_and_si256(d, bomb256));
+        _mm256_storeu_si256((__m256i *)(out + x), sum);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i bomb128 = _mm_set1_epi8(CELL_BOMB);
+    for (; x + 16 <= n; x += 16) {
+        __m128i u = _mm_loadu_si128((const __m128i *)(up + x));
+        __m128i m = _mm_loadu_si128((const __m128i *)(mid + x));
+        __m128i d = _mm_loadu_si128((const __m128i *)(down + x));
+        __m128i sum = _mm_add_epi8(_mm_and_si128(u, bomb128),
+                                   _mm_and_si128(m, bomb128));
+        sum = _mm_add_epi8(sum, _mm_and_si128(d, bomb128));
+        _mm_storeu_si128((__m128i *)(out + x), sum);
+    }
+#endif
+
+    for (; x < n; x++)
+        out[x] = (up[x] & CELL_BOMB) + (mid[x] & CELL_BOMB) + (down[x] & CELL_BOMB);
+}
+
+/* Adds three neighboring column sums into each cell's count. columns[0] is
+ * the zero padding left of the row, so cell x sums columns[x..x+2]. Bombs
+ * keep a count of zero */
+static void write_bomb_counts(cell *row, const uint8_t *columns, int n)
+{
+    int x = 0;
+
+#if defined(__AVX2__)
+    const __m256i bomb256  = _mm256_set1_epi8(CELL_BOMB);
+    const __m256i state256 = _mm256_set1_epi8((char)~CELL_COUNT);
+    const __m256i count256 = _mm256_set1_epi8(CELL_COUNT);
+    for (; x + 32 <= n; x += 32) {
+        __m256i l = _mm256_loadu_si256((const __m256i *)(columns + x));
+        __m256i m = _mm256_loadu_si256((const __m256i *)(columns + x + 1));
+        __m256i r = _mm256_loadu_si256((const __m256i *)(columns + x + 2));
+        __m256i c = _mm256_loadu_si256((const __m256i *)(row + x));
+
+        __m256i sum    = _mm256_add_epi8(_mm256_add_epi8(l, m), r);
+        __m256i count  = _mm256_and_si256(_mm256_srli_epi16(sum, 4), count256);
+        __m256i bombs  = _mm256_cmpeq_epi8(_mm256_and_si256(c, bomb256), bomb256);
+        __m256i result = _mm256_or_si256(_mm256_and_si256(c, state256),
+                                         _mm256_andnot_si256(bombs, count));
+        _mm256_storeu_si256((__m256i *)(row + x), result);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i bomb128  = _mm_set1_epi8(CELL_BOMB);
+    const __m128i state128 = _mm_set1_epi8((char)~CELL_COUNT);
+    const __m128i count128 = _mm_set1_epi8(CELL_COUNT);
+    for (; x + 16 <= n; x += 16) {
+        __m128i l = _mm_loadu_si128((const __m128i *)(columns + x));
+        __m128i m = _mm_loadu_si128((const __m128i *)(columns + x + 1));
+        __m128i r = _mm_loadu_si128((const __m128i *)(columns + x + 2));
+        __m128i c = _mm_loadu_si128((const __m128i *)(row + x));
+
+        __m128i sum    = _mm_add_epi8(_mm_add_epi8(l, m), r);
+        __m128i count  = _mm_and_si128(_mm_srli_epi16(sum, 4), count128);
+        __m128i bombs  = _mm_cmpeq_epi8(_mm_and_si128(c, bomb128), bomb128);
+        __m128i result = _mm_or_si128(_mm_and_si128(c, state128),
+                                      _mm_andnot_si128(bombs, count));
+        _mm_storeu_si128((__m128i *)(row + x), result);
+    }
+#endif
+
+    for (; x < n; x++) {
+        uint8_t count = (columns[x] + columns[x + 1] + columns[x + 2]) >> 4;
+        row[x] = (row[x] & ~CELL_COUNT) | ((row[x] & CELL_BOMB) ? 0 : count);
+    }
+}
+
+/* Fills in the neighbor count of every cell at once. Each row sums the bomb
+ * bits of the rows around it column by column, then adds up three columns
+ * per cell, which streams the board through memory once */
+static bool count_neighboring_bombs(board *b)
+{
+    int w = b->width;
+
+    // A zero row stands in for the rows outside the board
+    uint8_t *scratch = board_calloc(2 * (size_t)w + 2, 1);
+    if (!scratch) return false;
+    const cell *zero_row = scratch;
+    uint8_t *columns     = scratch + w; // columns[0] and columns[w+1] stay 0
+
+    for (int y = 0; y < b->height; y++) {
+        cell *row        = &BOARD_CELL(b, 0, y);
+        const cell *up   = y > 0             ? row - w : zero_row;
+        const cell *down = y < b->height - 1 ? row + w : zero_row;
+
+        sum_bomb_columns(up, row, down, columns + 1, w);
+        write_bomb_counts(row, columns, w);
+    }
+
+    board_free(scratch);
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Generation
+//------------------------------------------------------------------------------
+
+/* xoshiro256** seeded through splitmix64, see https://prng.di.unimi.it */
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static void seed_random(uint64_t state[4], uint64_t seed)
+{
+    for (int i = 0; i < 4; i++) {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        state[i] = z ^ (z >> 31);
+    }
+}
+
+static inline uint64_t next_random(uint64_t state[4])
+{
+    uint64_t result = rotl(state[1] * 5, 7) * 9;
+    uint64_t t = state[1] << 17;
+
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = rotl(state[3], 45);
+
+    return result;
+}
+
+// Unbiased number in [0, bound) using Lemire's multiply and shift
+static inline uint32_t random_below(uint64_t state[4], uint32_t bound)
+{
+    uint64_t m = (next_random(state) >> 32) * bound;
+    uint32_t low = (uint32_t)m;
+
+    if (low < bound) {
+        uint32_t threshold = -bound % bound;
+        while (low < threshold) {
+            m = (next_random(state) >> 32) * bound;
+            low = (uint32_t)m;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+
+//------------------------------------------------------------------------------
+// Summaries
+//------------------------------------------------------------------------------
+
+/* Chunks of every level, their stale flags and lists in one allocation,
+ * levels until one chunk covers the board */
+static void create_summaries(board *b)
+{
+    int count = 1;
+    while (((int64_t)b->width  - 1) >> (BOARD_CHUNK_SHIFT + count - 1) > 0 ||
+           ((int64_t)b->height - 1) >> (BOARD_CHUNK_SHIFT + count - 1) > 0)
+        count++;
+
+    size_t chunks = 0, upper = 0;
+    for (int i = 0; i < count; i++) {
+        int shift = BOARD_CHUNK_SHIFT + i;
+        size_t n  = (size_t)(((int64_t)b->width  - 1) >> shift) + 1;
+        n        *= (size_t)(((int64_t)b->height - 1) >> shift) + 1;
+        chunks   += n;
+        if (i > 0) upper += n;
+    }
+
+    size_t size = count * sizeof(board_summary_level) + chunks * sizeof(board_summary) +
+                  upper * sizeof(uint32_t) + upper;
+    uint8_t *memory = board_calloc(1, size);
+    if (!memory) return;
+
+    board_summary_level *levels = (board_summary_level*)memory;
+    board_summary *summaries    = (board_summary*)(levels + count);
+    uint32_t *lists             = (uint32_t*)(summaries + chunks);
+    uint8_t *stale              = (uint8_t*)(lists + upper);
+
+    for (int i = 0; i < count; i++) {
+        int shift = BOARD_CHUNK_SHIFT + i;
+        board_summary_level *l = &levels[i];
+        l->cols   = (int)((((int64_t)b->width  - 1) >> shift) + 1);
+        l->rows   = (int)((((int64_t)b->height - 1) >> shift) + 1);
+        l->chunks = summaries;
+        summaries += (size_t)l->cols * l->rows;
+
+        if (i > 0) {
+            l->stale_list = lists;
+            l->stale      = stale;
+            lists += (size_t)l->cols * l->rows;
+            stale += (size_t)l->cols * l->rows;
+        }
+    }
+
+    b->levels      = levels;
+    b->level_count = count;
+}
+
+static void clear_summaries(board *b)
+{
+    for (int i = 0; i < b->level_count; i++) {
+        board_summary_level *l = &b->levels[i];
+        size_t n = (size_t)l->cols * l->rows;
+        memset(l->chunks, 0, n * sizeof(board_summary));
+        if (l->stale) memset(l->stale, 0, n);
+        l->stale_count = 0;
+    }
+}
+
+/* Counts a change of a cell into its level 0 chunk. The chunks
+ * above it are only marked, once a marked one is reached the rest above
+ * are marked already */
+static void summarize(board *b, int x, int y, int revealed, int flagged)
+{
+    if (!b->levels) return;
+
+    board_summary_level *l = &b->levels[0];
+    board_summary *s = &l->chunks[(size_t)(y >> BOARD_CHUNK_SHIFT) * l->cols +
+                                  (x >> BOARD_CHUNK_SHIFT)];
+    s->revealed += revealed;
+    s->flagged  += flagged;
+
+    for (int i = 1; i < b->level_count; i++) {
+        l = &b->levels[i];
+        int shift      = BOARD_CHUNK_SHIFT + i;
+        uint32_t chunk = (uint32_t)(y >> shift) * l->cols + (uint32_t)(x >> shift);
+        if (l->stale[chunk]) break;
+
+        l->stale[chunk] = 1;
+        l->stale_list[l->stale_count++] = chunk;
+    }
+}
+
+int board_summary_levels(const board *b)
+{
+    return b->level_count;
+}
+
+const board_summary *board_get_summary(board *b, int level, int *cols, int *rows)
+{
+    if (level < 0 || level >= b->level_count) return NULL;
+
+    // Every level is recounted from the one below, so go up from level 1
+    for (int i = 1; i <= level; i++) {
+        board_summary_level *l     = &b->levels[i];
+        board_summary_level *below = &b->levels[i - 1];
+
+        for (size_t k = 0; k < l->stale_count; k++) {
+            uint32_t chunk = l->stale_list[k];
+            int cy = (int)(chunk / (uint32_t)l->cols);
+            int cx = (int)(chunk - (uint32_t)cy * l->cols);
+
+            board_summary sum = {0};
+            for (int y = cy * 2; y < BOARD_MIN(cy * 2 + 2, below->rows); y++) {
+                for (int x = cx * 2; x < BOARD_MIN(cx * 2 + 2, below->cols); x++) {
+                    board_summary part = below->chunks[(size_t)y * below->cols + x];
+                    sum.revealed += part.revealed;
+                    sum.flagged  += part.flagged;
+                }
+            }
+
+            l->chunks[chunk] = sum;
+            l->stale[chunk]  = 0;
+        }
+        l->stale_count = 0;
+    }
+
+    *cols = b->levels[level].cols;
+    *rows = b->levels[level].rows;
+    return b->levels[level].chunks;
+}
+
+
+void board_reset(board *b, uint64_t seed)
+{
+    size_t cells = (size_t)b->width * b->height;
+
+    /* Only clear the board here, the bombs are placed by board_generate on
+     * the first reveal so that the first click can never hit one */
+    memset(b->cells, 0, cells * sizeof(cell));
+    b->seed        = seed;
+    b->generated   = false;
+    b->status      = BOARD_PLAYING;
+    b->hidden_safe = cells - b->num_bombs;
+    b->flags       = 0;
+    b->questions   = 0;
+
+    clear_summaries(b);
+    board_mark_all_dirty(b);
+}
+
+bool board_generate(board *b, int safe_x, int safe_y)
+{
+    uint32_t cells = (uint32_t)b->width * (uint32_t)b->height;
+
+    seed_random(b->rng, b->seed);
+
+    // Keep the clicked cell and its neighbors clear when there is room
+    int x0 = BOARD_MAX(safe_x - 1, 0);
+    int y0 = BOARD_MAX(safe_y - 1, 0);
+    int x1 = BOARD_MIN(safe_x + 1, b->width - 1);
+    int y1 = BOARD_MIN(safe_y + 1, b->height - 1);
+    uint32_t safe = (uint32_t)((x1 - x0 + 1) * (y1 - y0 + 1));
+
+    if (cells - safe < (uint32_t)b->num_bombs) {
+        x0 = x1 = safe_x;
+        y0 = y1 = safe_y;
+        safe = 1;
+    }
+    uint32_t available = cells - safe;
+
+    /* Place exactly num_bombs by picking random cells and retrying the ones
+     * already taken. Dense boards start out full and pick the safe cells
+     * instead, so there are never more picks than half the board. Flags
+     * and question marks placed before the first click are kept */
+    bool invert     = (uint32_t)b->num_bombs > available / 2;
+    uint32_t target = invert ? available - b->num_bombs : (uint32_t)b->num_bombs;
+
+    if (invert) {
+        for (uint32_t i = 0; i < cells; i++) b->cells[i] |= CELL_BOMB;
+        for (int y = y0; y <= y1; y++)
+            for (int x = x0; x <= x1; x++) BOARD_CELL(b, x, y) &= ~CELL_BOMB;
+    }
+
+    for( uint32_t placed = 0; placed < target; ){
+        uint32_t index = random_below(b->rng, cells);
+        int x = index % b->width;
+        int y = index / b->width;
+        if( x >= x0 && x <= x1 && y >= y0 && y <= y1 )
+            continue;
+
+        cell *c = &b->cells[index];
+        if( ((*c & CELL_BOMB) != 0) == invert ){
+            *c ^= CELL_BOMB;
+            placed++;
+        }
+    }
+
+    // Take the bombs back out so a later call can try again
+    if (!count_neighboring_bombs(b)) {
+        for (uint32_t i = 0; i < cells; i++) b->cells[i] &= ~CELL_BOMB;
+        return false;
+    }
+
+    b->generated = true;
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+// Lifecycle
+//------------------------------------------------------------------------------
+
+board *board_create(int width, int height, int num_bombs, uint64_t seed)
+{
+    if (width <= 0 || height <= 0) return NULL;
+
+    size_t cells = (size_t)width * (size_t)height;
+    if (cells > UINT32_MAX) return NULL;
+
+    // At least one cell has to be safe, or the game can never be won
+    if (num_bombs < 0 || (size_t)num_bombs >= cells) return NULL;
+
+    board *b = board_malloc(sizeof(board) + cells * sizeof(cell));
+    if (!b) return NULL;
+
+    b->width         = width;
+    b->height        = height;
+    b->num_bombs     = num_bombs;
+    b->work          = NULL;
+    b->work_capacity = 0;
+    b->dirty         = NULL;
+    b->dirty_count   = 0;
+    b->levels        = NULL;
+    b->level_count   = 0;
+
+    // The board works without summaries, they are only for drawing
+    create_summaries(b);
+
+    board_reset(b, seed);
+    return b;
+}
+
+void board_destroy(board *b)
+{
+    if (!b) return;
+    board_free(b->work);
+    board_free(b->dirty);
+    board_free(b->levels);
+    board_free(b);
+}
+
+//------------------------------------------------------------------------------
+// Dirty Cells
+//------------------------------------------------------------------------------
+
+static void push_dirty(board *b, uint32_t index)
+{
+    if (b->all_dirty) return;
+
+    if (!b->dirty) b->dirty = board_malloc(BOARD_DIRTY_CAPACITY * sizeof(uint32_t));
+
+    // Out of room, or out of memory, the whole board gets redrawn instead
+    if (!b->dirty || b->dirty_count == BOARD_DIRTY_CAPACITY) {
+        b->all_dirty = true;
+        return;
+    }
+    b->dirty[b->dirty_count++] = index;
+}
+
+bool board_get_dirty(const board *b, const uint32_t **cells, size_t *count)
+{
+    *cells = b->dirty;
+    *count = b->all_dirty ? 0 : b->dirty_count;
+    return !b->all_dirty;
+}
+
+void board_clear_dirty(board *b)
+{
+    b->dirty_count = 0;
+    b->all_dirty   = false;
+}
+
+void board_mark_dirty(board *b, int x, int y)
+{
+    if( x < 0 || x >= b->width || y < 0 || y >= b->height )
+        return;
+    push_dirty(b, (uint32_t)y * b->width + x);
+}
+
+void board_mark_all_dirty(board *b)
+{
+    b->all_dirty   = true;
+    b->dirty_count = 0;
+}
+
+//------------------------------------------------------------------------------
+// Moves
+//------------------------------------------------------------------------------
+
+/* Appends a cell index to the work list, growing it when full. The list
+ * never holds more entries than there are cells */
+static bool push_work(board *b, size_t *count, uint32_t index)
+{
+    if (*count == b->work_capacity) {
+        size_t cells    = (size_t)b->width * b->height;
+        size_t capacity = b->work_capacity ? b->work_capacity * 2 : 1024;
+        if (capacity > cells) capacity = cells;
+
+        uint32_t *work = board_realloc(b->work, capacity * sizeof(uint32_t));
+        if (!work) return false;
+        b->work          = work;
+        b->work_capacity = capacity;
+    }
+
+    b->work[(*count)++] = index;
+    return true;
+}
+
+/* Reveals a hidden safe tile, a revealed tile can't keep its question
+ * mark. Blank tiles are queued when they are revealed, so every cell
+ * enters the work list at most once */
+static size_t reveal_cell(board *b, int x, int y, size_t *count)
+{
+    uint32_t index = (uint32_t)y * b->width + x;
+    cell *c = &b->cells[index];
+    if( *c & (CELL_REVEALED | CELL_BOMB | CELL_FLAGGED) )
+        return 0;
+
+    if( *c & CELL_QUESTION ) b->questions--;
+    *c = (*c | CELL_REVEALED) & ~CELL_QUESTION;
+    push_dirty(b, index);
+    summarize(b, x, y, 1, 0);
+
+    // Out of memory only stops the fill from expanding past this tile
+    if( !(*c & CELL_COUNT) ) push_work(b, count, index);
+    return 1;
+}
+
+// Reveals the neighbors of every blank tile on the work list until it is empty
+static size_t flood_reveal(board *b, size_t count)
+{
+    size_t revealed = 0;
+
+    while( count > 0 ){
+        uint32_t index = b->work[--count];
+        int cx = index % b->width;
+        int cy = index / b->width;
+
+        int x0 = cx > 0 ? cx - 1 : 0;
+        int y0 = cy > 0 ? cy - 1 : 0;
+        int x1 = cx < b->width  - 1 ? cx + 1 : cx;
+        int y1 = cy < b->height - 1 ? cy + 1 : cy;
+
+        for( int ny = y0; ny <= y1; ny++ )
+            for( int nx = x0; nx <= x1; nx++ )
+                revealed += reveal_cell(b, nx, ny, &count);
+    }
+
+    return revealed;
+}
+
+// Reveals a bomb, losing the game
+static void reveal_bomb(board *b, cell *c)
+{
+    if( *c & CELL_QUESTION ) b->questions--;
+    *c = (*c | CELL_REVEALED) & ~CELL_QUESTION;
+    uint32_t index = (uint32_t)(c - b->cells);
+    push_dirty(b, index);
+    summarize(b, (int)(index % (uint32_t)b->width), (int)(index / (uint32_t)b->width), 1, 0);
+    b->status = BOARD_LOST;
+}
+
+// Settles the counters once per move and checks for a win
+static size_t finish_move(board *b, size_t revealed)
+{
+    b->hidden_safe -= revealed;
+    if( b->hidden_safe == 0 && b->status == BOARD_PLAYING )
+        b->status = BOARD_WON;
+    return revealed;
+}
+
+size_t board_reveal(board *b, int x, int y)
+{
+    // Check if the tile coordinates are within the board bounds
+    if( x < 0 || x >= b->width || y < 0 || y >= b->height )
+        return 0;
+
+    if( b->status != BOARD_PLAYING )
+        return 0;
+
+    cell *c = &BOARD_CELL(b, x, y);
+    if( *c & (CELL_REVEALED | CELL_FLAGGED) )
+        return 0;
+
+    if( !b->generated && !board_generate(b, x, y) )
+        return 0;
+
+    if( *c & CELL_BOMB ){
+        reveal_bomb(b, c);
+        return 0;
+    }
+
+    size_t count    = 0;
+    size_t revealed = reveal_cell(b, x, y, &count);
+    revealed       += flood_reveal(b, count);
+
+    return finish_move(b, revealed);
+}
+
+size_t board_chord(board *b, int x, int y)
+{
+    if( x < 0 || x >= b->width || y < 0 || y >= b->height )
+        return 0;
+
+    if( b->status != BOARD_PLAYING )
+        return 0;
+
+    // Only a revealed number can be chorded
+    cell number = BOARD_CELL(b, x, y);
+    if( !(number & CELL_REVEALED) || !(number & CELL_COUNT) )
+        return 0;
+
+    int x0 = x > 0 ? x - 1 : 0;
+    int y0 = y > 0 ? y - 1 : 0;
+    int x1 = x < b->width  - 1 ? x + 1 : x;
+    int y1 = y < b->height - 1 ? y + 1 : y;
+
+    int flags = 0;
+    for( int ny = y0; ny <= y1; ny++ )
+        for( int nx = x0; nx <= x1; nx++ )
+            if( BOARD_CELL(b, nx, ny) & CELL_FLAGGED ) flags++;
+
+    if( flags != (number & CELL_COUNT) )
+        return 0;
+
+    /* Every hidden neighbor is seeded into the same work list, so the
+     * whole chord is revealed by one flood fill. Bombs under a wrong flag
+     * guess are revealed as well */
+    size_t count    = 0;
+    size_t revealed = 0;
+    for( int ny = y0; ny <= y1; ny++ ){
+        for( int nx = x0; nx <= x1; nx++ ){
+            cell *c = &BOARD_CELL(b, nx, ny);
+            if( *c & (CELL_REVEALED | CELL_FLAGGED) )
+                continue;
+
+            if( *c & CELL_BOMB ){
+                reveal_bomb(b, c);
+                continue;
+            }
+
+            revealed += reveal_cell(b, nx, ny, &count);
+        }
+    }
+    revealed += flood_reveal(b, count);
+
+    return finish_move(b, revealed);
+}
+
+
+void board_flag(board *b, int x, int y)
+{
+    if( x < 0 || x >= b->width || y < 0 || y >= b->height )
+        return;
+
+    cell *c = &BOARD_CELL(b, x, y);
+    if( *c & CELL_REVEALED || b->status != BOARD_PLAYING )
+        return;
+
+    if( !(*c & (CELL_FLAGGED | CELL_QUESTION)) ){
+        *c |= CELL_FLAGGED;
+        b->flags++;
+        summarize(b, x, y, 0, 1);
+    }
+    else if( *c & CELL_FLAGGED ){
+        *c = (*c & ~CELL_FLAGGED) | CELL_QUESTION;
+        b->flags--;
+        b->questions++;
+        summarize(b, x, y, 0, -1);
+    }
+    else {
+        *c &= ~CELL_QUESTION;
+        b->questions--;
+    }
+
+    board_mark_dirty(b, x, y);
+}
+
+//------------------------------------------------------------------------------
+// Queries
+//------------------------------------------------------------------------------
+
+cell board_get_cell(const board *b, int x, int y)
+{
+    if( x < 0 || x >= b->width || y < 0 || y >= b->height )
+        return 0;
+    return BOARD_CELL(b, x, y);
+}
+
+board_status board_get_status(const board *b)
+{
+    return b->status;
+}
+
+int board_bombs_left(const board *b)
+{
+    return b->num_bombs - b->flags;
+}
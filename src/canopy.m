@@ -500,6 +500,7 @@ bool canopy_init_framebuffer(canopy_window *win)
 
 void canopy_present_buffer(canopy_window *window)
 {
+    CANOPY_PROFILE_BEGIN(canopy_present);
     @autoreleasepool {
         if (!window->fb.pixels) {
             ERROR("Tried to present a NULL framebuffer");
@@ -528,9 +529,25 @@ void canopy_present_buffer(canopy_window *window)
         [(NSView*)window->view layer].contents = image;
         //TRACE("Framebuffer presented to screen");
     }
+    CANOPY_PROFILE_END(canopy_present);
 }
 
 
+/* Only the damaged regions are copied into the framebuffer. The layer
+ * contents are replaced as a whole, CALayer has no partial update, but
+ * frames without damage are not handed over at all */
+void canopy_present_damage(canopy_window *window, const framebuffer *src,
+                           const canopy_rect *rects, int count)
+{
+    canopy_rect merged[CANOPY_MAX_DAMAGE_RECTS];
+    int n = canopy_merge_rects(merged, CANOPY_MAX_DAMAGE_RECTS, rects, count,
+                               window->fb.width, window->fb.height);
+    if (n == 0) return;
+
+    if (src) canopy_copy_rects(&window->fb, src, merged, n);
+    canopy_present_buffer(window);
+}
+
 framebuffer *canopy_get_framebuffer(canopy_window *window)
 {
     return &window->fb;
@@ -622,3 +639,10 @@ void canopy_wait_events_timeout(double timeout_seconds)
         }
     }
 }
+
+bool canopy_load_script(const char *filepath)
+{
+    // Input comes from the window, scripts are for the headless backend
+    WARN("Event scripts need the headless backend, ignoring %s", filepath);
+    return false;
+}
@@ -0,0 +1,90 @@
+#include "canopy.h"
+
+/* Clipping and merging of damage rectangles, shared by the backends so
+ * each present only has to copy or upload what is left */
+
+static inline int canopy__area(canopy_rect r)
+{
+    return r.width * r.height;
+}
+
+static inline canopy_rect canopy__union(canopy_rect a, canopy_rect b)
+{
+    int x0 = a.x < b.x ? a.x : b.x;
+    int y0 = a.y < b.y ? a.y : b.y;
+    int x1 = a.x + a.width  > b.x + b.width  ? a.x + a.width  : b.x + b.width;
+    int y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+    return (canopy_rect){ x0, y0, x1 - x0, y1 - y0 };
+}
+
+static bool canopy__clip(canopy_rect *r, int width, int height)
+{
+    // Negative sizes grow up and to the left, as in picasso
+    if (r->width < 0)  { r->x += r->width;  r->width  = -r->width;  }
+    if (r->height < 0) { r->y += r->height; r->height = -r->height; }
+
+    int x0 = r->x > 0 ? r->x : 0;
+    int y0 = r->y > 0 ? r->y : 0;
+    int x1 = r->x + r->width  < width  ? r->x + r->width  : width;
+    int y1 = r->y + r->height < height ? r->y + r->height : height;
+    if (x0 >= x1 || y0 >= y1) return false;
+
+    *r = (canopy_rect){ x0, y0, x1 - x0, y1 - y0 };
+    return true;
+}
+
+int canopy_merge_rects(canopy_rect *out, int max, const canopy_rect *rects,
+                       int count, int width, int height)
+{
+    if (!out || max <= 0 || !rects) return 0;
+
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        canopy_rect r = rects[i];
+        if (!canopy__clip(&r, width, height)) continue;
+
+        /* Fold in every rectangle that merges cheaply, the grown rectangle
+         * may reach new ones so start over after each merge */
+        for (int j = 0; j < n; j++) {
+            canopy_rect u = canopy__union(out[j], r);
+            if (canopy__area(u) > canopy__area(out[j]) + canopy__area(r))
+                continue;
+
+            r = u;
+            out[j] = out[--n];
+            j = -1;
+        }
+
+        if (n == max) {
+            for (int j = 1; j < n; j++) out[0] = canopy__union(out[0], out[j]);
+            out[0] = canopy__union(out[0], r);
+            n = 1;
+            continue;
+        }
+        out[n++] = r;
+    }
+
+    return n;
+}
+
+void canopy_copy_rects(framebuffer *dst, const framebuffer *src,
+                       const canopy_rect *rects, int count)
+{
+    if (!dst || !src || !dst->pixels || !src->pixels) return;
+
+    for (int i = 0; i < count; i++) {
+        canopy_rect r = rects[i];
+        size_t bytes  = (size_t)r.width * CANOPY_BYTES_PER_PIXEL;
+
+        const uint8_t *from = (const uint8_t*)src->pixels +
+                              (size_t)r.y * src->pitch + (size_t)r.x * CANOPY_BYTES_PER_PIXEL;
+        uint8_t *to         = (uint8_t*)dst->pixels +
+                              (size_t)r.y * dst->pitch + (size_t)r.x * CANOPY_BYTES_PER_PIXEL;
+
+        for (int y = 0; y < r.height; y++) {
+            memcpy(to, from, bytes);
+            from += src->pitch;
+            to   += dst->pitch;
+        }
+    }
+}
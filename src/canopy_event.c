@@ -1,21 +1,120 @@
+#include <stdatomic.h>
+
 #include "canopy.h"
 
-static canopy_event event_queue[CANOPY_MAX_EVENTS];
-static int event_head = 0;
-static int event_tail = 0;
+/* Single producer, single consumer ring. The producer owns tail and the
+ * consumer owns head, both count up forever and are masked into the ring.
+ * Publishing a slot is a release store of tail, claiming one back is a
+ * release store of head, so neither side ever waits on the other */
+
+_Static_assert((CANOPY_MAX_EVENTS & (CANOPY_MAX_EVENTS - 1)) == 0,
+               "CANOPY_MAX_EVENTS must be a power of two");
+
+#define CANOPY_EVENT_MASK (CANOPY_MAX_EVENTS - 1)
+
+static struct {
+    canopy_event ring[CANOPY_MAX_EVENTS];
 
-void canopy_push_event(canopy_event ev) {
-    int next = (event_tail + 1) % CANOPY_MAX_EVENTS;
-    if (next != event_head) { // only add if queue not full
-        event_queue[event_tail] = ev;
-        event_tail = next;
+    _Alignas(64) atomic_size_t head;    // next slot to poll, consumer
+    _Alignas(64) atomic_size_t tail;    // next slot to fill, producer
+
+    // Producer counters, read by anyone
+    atomic_uint_fast64_t pushed;
+    atomic_uint_fast64_t dropped;
+    atomic_uint_fast32_t high_water;
+
+    // Consumer counters
+    _Alignas(64) atomic_uint_fast64_t coalesced;
+    atomic_uint_fast64_t polled;
+    atomic_uint_fast64_t total_latency_ns;
+    atomic_uint_fast64_t max_latency_ns;
+} canopy__events;
+
+void canopy_push_event(canopy_event ev)
+{
+    if (ev.timestamp_ns == 0) ev.timestamp_ns = canopy_get_time_ns();
+
+    size_t tail = atomic_load_explicit(&canopy__events.tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&canopy__events.head, memory_order_acquire);
+
+    if (tail - head == CANOPY_MAX_EVENTS) {
+        atomic_fetch_add_explicit(&canopy__events.dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    canopy__events.ring[tail & CANOPY_EVENT_MASK] = ev;
+    atomic_store_explicit(&canopy__events.tail, tail + 1, memory_order_release);
+
+    atomic_fetch_add_explicit(&canopy__events.pushed, 1, memory_order_relaxed);
+    uint32_t queued = (uint32_t)(tail + 1 - head);
+    if (queued > atomic_load_explicit(&canopy__events.high_water, memory_order_relaxed))
+        atomic_store_explicit(&canopy__events.high_water, queued, memory_order_relaxed);
+}
+
+/* Moves fold into moves and drags into drags of the same button, anything
+ * else in between keeps them apart */
+static bool canopy__coalesces(const canopy_event *a, const canopy_event *b)
+{
+    if (a->type != CANOPY_EVENT_MOUSE || b->type != CANOPY_EVENT_MOUSE)
+        return false;
+    if (a->mouse.action != b->mouse.action) return false;
+
+    switch (a->mouse.action) {
+        case CANOPY_MOUSE_MOVE: return a->mouse.modifiers == b->mouse.modifiers;
+        case CANOPY_MOUSE_DRAG: return a->mouse.button == b->mouse.button &&
+                                       a->mouse.modifiers == b->mouse.modifiers;
+        default: return false;
     }
 }
 
 bool canopy_poll_event(canopy_event* out_event)
 {
-    if (event_head == event_tail) return false;
-    *out_event = event_queue[event_head];
-    event_head = (event_head + 1) % CANOPY_MAX_EVENTS;
+    size_t head = atomic_load_explicit(&canopy__events.head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&canopy__events.tail, memory_order_acquire);
+    if (head == tail) return false;
+
+    canopy_event ev = canopy__events.ring[head++ & CANOPY_EVENT_MASK];
+
+    // Skip ahead to the last of a run of moves, the first one waited longest
+    while (head != tail) {
+        const canopy_event *next = &canopy__events.ring[head & CANOPY_EVENT_MASK];
+        if (!canopy__coalesces(&ev, next)) break;
+
+        uint64_t first = ev.timestamp_ns;
+        ev = *next;
+        ev.timestamp_ns = first;
+        head++;
+        atomic_fetch_add_explicit(&canopy__events.coalesced, 1, memory_order_relaxed);
+    }
+
+    atomic_store_explicit(&canopy__events.head, head, memory_order_release);
+
+    // Traces show events when they were pushed, next to the frames they wait for
+    if (ev.type == CANOPY_EVENT_KEY) CANOPY_PROFILE_INSTANT(key, ev.timestamp_ns);
+    else                             CANOPY_PROFILE_INSTANT(mouse, ev.timestamp_ns);
+
+    uint64_t now     = canopy_get_time_ns();
+    uint64_t latency = now > ev.timestamp_ns ? now - ev.timestamp_ns : 0;
+    atomic_fetch_add_explicit(&canopy__events.polled, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&canopy__events.total_latency_ns, latency, memory_order_relaxed);
+    if (latency > atomic_load_explicit(&canopy__events.max_latency_ns, memory_order_relaxed))
+        atomic_store_explicit(&canopy__events.max_latency_ns, latency, memory_order_relaxed);
+
+    *out_event = ev;
     return true;
 }
+
+void canopy_get_event_stats(canopy_event_stats* out_stats)
+{
+    if (!out_stats) return;
+
+    *out_stats = (canopy_event_stats){
+        .pushed           = atomic_load_explicit(&canopy__events.pushed, memory_order_relaxed),
+        .dropped          = atomic_load_explicit(&canopy__events.dropped, memory_order_relaxed),
+        .coalesced        = atomic_load_explicit(&canopy__events.coalesced, memory_order_relaxed),
+        .polled           = atomic_load_explicit(&canopy__events.polled, memory_order_relaxed),
+        .high_water       = (uint32_t)atomic_load_explicit(&canopy__events.high_water, memory_order_relaxed),
+        .total_latency_ns = atomic_load_explicit(&canopy__events.total_latency_ns, memory_order_relaxed),
+        .max_latency_ns   = atomic_load_explicit(&canopy__events.max_latency_ns, memory_order_relaxed),
+    };
+}
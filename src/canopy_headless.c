@@ -0,0 +1,490 @@
+/*******************************************************************************
+ * Canopy — Headless backend
+ *
+ * Implements the window, framebuffer, present and event API of canopy.h
+ * without a display. Frames are rendered into memory and input comes from
+ * an event script, so the game loop can run unattended on any POSIX box.
+ *
+ * The script is read from the file named by CANOPY_SCRIPT, or loaded with
+ * canopy_load_script(). One command per line, '#' starts a comment:
+ *
+ *     wait <ms>                   hold the next commands back for ms
+ *     move <x> <y>                mouse move, a drag while a button is held
+ *     press <button> <x> <y>      button is left, right or middle
+ *     release <button> <x> <y>
+ *     click <button> <x> <y>      press and release
+ *     scroll <x> <y> <dx> <dy>
+ *     key <name> [press|release]  names as canopy_key_to_string, both
+ *                                 actions when none is given
+ *     screenshot <path>           write the last presented frame as a PPM
+ *     close                       ask the window to close
+ *
+ * The window closes by itself at the end of the script.
+ *******************************************************************************/
+
+#include <time.h>
+#include <errno.h>
+#include <blackbox.h>
+
+#include "canopy.h"
+
+//----------------------------------------
+// Struct to hold the headless window
+//----------------------------------------
+struct canopy_window {
+    framebuffer fb;
+
+    bool should_close;
+    bool is_opaque;
+};
+
+static struct {
+    canopy_window *window;  // Window the script drives, only one exists
+
+    FILE *script;
+    const char *path;
+    int line;
+    uint64_t due_ns;        // Next command runs at this time
+    unsigned held_buttons;  // Turns moves into drags
+    bool finished;          // Closes the window once the last events are read
+} headless;
+
+//--------------------------------------------------------------------------------
+// Event script
+//--------------------------------------------------------------------------------
+
+static bool canopy__parse_button(const char *name, mouse_buttons *out)
+{
+    if      (strcmp(name, "left")   == 0) *out = CANOPY_MOUSE_BUTTON_LEFT;
+    else if (strcmp(name, "right")  == 0) *out = CANOPY_MOUSE_BUTTON_RIGHT;
+    else if (strcmp(name, "middle") == 0) *out = CANOPY_MOUSE_BUTTON_MIDDLE;
+    else return false;
+    return true;
+}
+
+static bool canopy__parse_key(const char *name, keys *out)
+{
+    // The key codes fit in 7 bits, match them by their printable names
+    for (int k = 0; k < 0x80; k++) {
+        if (strcmp(canopy_key_to_string((keys)k), name) == 0) {
+            *out = (keys)k;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void canopy__push_mouse(canopy_mouse_action action, mouse_buttons button,
+                               int x, int y, float sx, float sy)
+{
+    canopy_event e = {
+        .type = CANOPY_EVENT_MOUSE,
+        .mouse.action = action,
+        .mouse.x = x,
+        .mouse.y = y,
+        .mouse.button = button,
+        .mouse.click_count = (action == CANOPY_MOUSE_PRESS ||
+                              action == CANOPY_MOUSE_RELEASE) ? 1 : 0,
+        .mouse.scroll_x = sx,
+        .mouse.scroll_y = sy,
+    };
+
+    if (action == CANOPY_MOUSE_PRESS)   headless.held_buttons |= 1u << button;
+    if (action == CANOPY_MOUSE_RELEASE) headless.held_buttons &= ~(1u << button);
+
+    canopy_push_event(e);
+}
+
+static void canopy__push_key(canopy_key_action action, keys key)
+{
+    canopy_event e = {
+        .type = CANOPY_EVENT_KEY,
+        .key.action = action,
+        .key.keycode = key,
+    };
+    canopy_push_event(e);
+}
+
+static void canopy__write_screenshot(const char *path)
+{
+    framebuffer *fb = &headless.window->fb;
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        ERROR("Could not open screenshot file: %s", path);
+        return;
+    }
+
+    // Pixels are stored as RGBA bytes, PPM wants RGB
+    fprintf(file, "P6\n%d %d\n255\n", fb->width, fb->height);
+    for (int y = 0; y < fb->height; y++) {
+        const uint8_t *row = (const uint8_t *)fb->pixels + (size_t)y * fb->pitch;
+        for (int x = 0; x < fb->width; x++) fwrite(row + x * 4, 1, 3, file);
+    }
+
+    fclose(file);
+    INFO("Wrote screenshot to %s", path);
+}
+
+static void canopy__close_script(void)
+{
+    if (!headless.script) return;
+
+    fclose(headless.script);
+    headless.script = NULL;
+
+    INFO("Event script %s finished", headless.path);
+    headless.finished = true;
+}
+
+/* Runs one script line, returns false on a malformed line so the caller
+ * can report it */
+static bool canopy__run_command(char *line)
+{
+    char command[32], name[192], action[16];
+    int x, y;
+    float dx, dy;
+    mouse_buttons button;
+    keys key;
+
+    char *comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+
+    if (sscanf(line, "%31s", command) != 1) return true; // Blank line
+
+    if (strcmp(command, "wait") == 0) {
+        double ms;
+        if (sscanf(line, "%*s %lf", &ms) != 1 || ms < 0) return false;
+        headless.due_ns += (uint64_t)(ms * 1e6);
+    }
+    else if (strcmp(command, "move") == 0) {
+        if (sscanf(line, "%*s %d %d", &x, &y) != 2) return false;
+
+        // Drags report the lowest button held, like Cocoa does
+        canopy_mouse_action move = CANOPY_MOUSE_MOVE;
+        button = CANOPY_MOUSE_BUTTON_LEFT;
+        for (int b = 0; b < CANOPY_MAX_MOUSE_BUTTONS; b++) {
+            if (headless.held_buttons & (1u << b)) {
+                move   = CANOPY_MOUSE_DRAG;
+                button = (mouse_buttons)b;
+                break;
+            }
+        }
+        canopy__push_mouse(move, button, x, y, 0, 0);
+    }
+    else if (strcmp(command, "press") == 0 ||
+             strcmp(command, "release") == 0 ||
+             strcmp(command, "click") == 0)
+    {
+        if (sscanf(line, "%*s %191s %d %d", name, &x, &y) != 3) return false;
+        if (!canopy__parse_button(name, &button)) return false;
+
+        if (command[0] != 'r')
+            canopy__push_mouse(CANOPY_MOUSE_PRESS, button, x, y, 0, 0);
+        if (command[0] != 'p')
+            canopy__push_mouse(CANOPY_MOUSE_RELEASE, button, x, y, 0, 0);
+    }
+    else if (strcmp(command, "scroll") == 0) {
+        if (sscanf(line, "%*s %d %d %f %f", &x, &y, &dx, &dy) != 4) return false;
+        canopy__push_mouse(CANOPY_MOUSE_SCROLL, CANOPY_MOUSE_BUTTON_LEFT,
+                           x, y, dx, dy);
+    }
+    else if (strcmp(command, "key") == 0) {
+        int fields = sscanf(line, "%*s %191s %15s", name, action);
+        if (fields < 1 || !canopy__parse_key(name, &key)) return false;
+
+        bool press   = fields == 1 || strcmp(action, "press") == 0;
+        bool release = fields == 1 || strcmp(action, "release") == 0;
+        if (!press && !release) return false;
+
+        if (press)   canopy__push_key(CANOPY_KEY_PRESS, key);
+        if (release) canopy__push_key(CANOPY_KEY_RELEASE, key);
+    }
+    else if (strcmp(command, "screenshot") == 0) {
+        if (sscanf(line, "%*s %191s", name) != 1) return false;
+        canopy__write_screenshot(name);
+    }
+    else if (strcmp(command, "close") == 0) {
+        if (headless.window) headless.window->should_close = true;
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+/* Runs every command that is due, stopping at the first wait that is
+ * still in the future. A command pushes at most two events, so a batch
+ * never overflows the event queue before the game polls it */
+#define CANOPY_SCRIPT_BATCH (CANOPY_MAX_EVENTS / 2)
+
+static void canopy__run_script(void)
+{
+    char line[256];
+
+    // Close once the game has polled the last events
+    if (headless.finished && headless.window) {
+        canopy_event_stats stats;
+        canopy_get_event_stats(&stats);
+        if (stats.polled + stats.coalesced == stats.pushed)
+            headless.window->should_close = true;
+        return;
+    }
+
+    for (int i = 0; i < CANOPY_SCRIPT_BATCH &&
+         headless.script && canopy_get_time_ns() >= headless.due_ns; i++) {
+        if (!fgets(line, sizeof(line), headless.script)) {
+            canopy__close_script();
+            break;
+        }
+
+        headless.line++;
+        if (!canopy__run_command(line)) {
+            WARN("%s:%d: Skipping malformed script line", headless.path,
+                 headless.line);
+        }
+    }
+}
+
+static void canopy__sleep_until(uint64_t deadline_ns)
+{
+    struct timespec ts = {
+        .tv_sec  = (time_t)(deadline_ns / 1000000000ull),
+        .tv_nsec = (long)(deadline_ns % 1000000000ull),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+bool canopy_load_script(const char *filepath)
+{
+    canopy__close_script();
+
+    headless.script = fopen(filepath, "r");
+    if (!headless.script) {
+        ERROR("Failed to open event script: %s", filepath);
+        return false;
+    }
+
+    headless.path     = filepath;
+    headless.line     = 0;
+    headless.due_ns   = canopy_get_time_ns();
+    headless.finished = false;
+
+    INFO("Loaded event script %s", filepath);
+    return true;
+}
+
+//--------------------------------------------------------------------------------
+// Public API Implementation
+//--------------------------------------------------------------------------------
+
+/* Window functions */
+canopy_window* canopy_create_window(const char* title,
+                                    int width,
+                                    int height,
+                                    canopy_window_style flags)
+{
+    (void)flags;
+    TRACE("Creating headless window: %dx%d \"%s\"", width, height, title);
+
+    canopy_window* win = canopy_calloc(1, sizeof(canopy_window));
+    if (!win) {
+        FATAL("Failed to allocate canopy_window");
+        return NULL;
+    }
+
+    win->fb.width     = width;
+    win->fb.height    = height;
+    win->is_opaque    = true;
+    win->should_close = false;
+
+    if (!canopy_init_framebuffer(win)) {
+        canopy_free(win);
+        return NULL;
+    }
+
+    headless.window = win;
+
+    const char *script = getenv("CANOPY_SCRIPT");
+    if (script) {
+        canopy_load_script(script);
+    } else if (!headless.script) {
+        WARN("No CANOPY_SCRIPT set, the headless window gets no input");
+    }
+
+    INFO("Created headless window: \"%s\" (%dx%d)", title, width, height);
+    return win;
+}
+
+void canopy_set_icon(const char* filepath)
+{
+    TRACE("Ignoring icon %s, no dock without a display", filepath);
+}
+
+bool canopy_is_window_opaque(canopy_window *win)
+{
+    return win->is_opaque;
+}
+void canopy_set_window_transparent(canopy_window *win, bool enable)
+{
+    win->is_opaque = !enable;
+}
+void canopy_free_window(canopy_window* win)
+{
+    if (!win) {
+        WARN("Tried to free a NULL window");
+        return;
+    }
+
+    if (headless.window == win) {
+        canopy__close_script();
+        headless.finished = false;
+        headless.window   = NULL;
+    }
+
+    if (win->fb.pixels) {
+        canopy_free(win->fb.pixels);
+        win->fb.pixels = NULL;
+    }
+
+    DEBUG("Headless window closed and resources cleaned up");
+    canopy_free(win);
+}
+
+void canopy_set_window_should_close(canopy_window *window)
+{
+    window->should_close = true;
+}
+bool canopy_window_should_close(canopy_window *window)
+{
+    canopy_pump_events();  // Feed the script
+    return window->should_close;
+}
+
+bool canopy_init_framebuffer(canopy_window *win)
+{
+    if(win->fb.pixels == NULL)
+    {
+        win->fb.pitch = win->fb.width * CANOPY_BYTES_PER_PIXEL;
+
+        if (win->fb.width <= 0 || win->fb.height <= 0)
+        {
+            ERROR("Invalid framebuffer size: %dx%d\n",
+                        win->fb.width, win->fb.height);
+            return false;
+        }
+        win->fb.pixels = canopy_calloc((size_t)win->fb.pitch * win->fb.height, 1);
+        if (!win->fb.pixels) {
+            FATAL("Failed to allocate framebuffer");
+            return false;
+        }
+        TRACE("Initialized framebuffer: %dx%d (pitch %d)",
+              win->fb.width, win->fb.height, win->fb.pitch);
+    }
+
+    return true;
+}
+
+void canopy_present_buffer(canopy_window *window)
+{
+    // The framebuffer is the screen, there is nothing to hand it to
+    if (!window->fb.pixels) {
+        ERROR("Tried to present a NULL framebuffer");
+    }
+}
+
+/* The framebuffer is what screenshots read, so presenting the damage is
+ * copying it in */
+void canopy_present_damage(canopy_window *window, const framebuffer *src,
+                           const canopy_rect *rects, int count)
+{
+    canopy_rect merged[CANOPY_MAX_DAMAGE_RECTS];
+    int n = canopy_merge_rects(merged, CANOPY_MAX_DAMAGE_RECTS, rects, count,
+                               window->fb.width, window->fb.height);
+    if (n == 0) return;
+
+    CANOPY_PROFILE_BEGIN(canopy_present);
+    if (src) canopy_copy_rects(&window->fb, src, merged, n);
+    CANOPY_PROFILE_END(canopy_present);
+
+    int pixels = 0;
+    for (int i = 0; i < n; i++) pixels += merged[i].width * merged[i].height;
+    TRACE("Presented %d pixels in %d rects", pixels, n);
+}
+
+framebuffer *canopy_get_framebuffer(canopy_window *window)
+{
+    return &window->fb;
+}
+
+void canopy_swap_backbuffer(canopy_window *w, framebuffer *backbuffer)
+{
+    if (!backbuffer || !backbuffer->pixels) {
+        ERROR("Backbuffer is NULL");
+        return;
+    }
+
+    if (!w->fb.pixels) {
+        ERROR("Framebuffer in window is NULL");
+        return;
+    }
+
+    // Same as the Cocoa backend, the buffers are equal so swap pointers
+    uint32_t *temp = w->fb.pixels;
+    w->fb.pixels = backbuffer->pixels;
+    backbuffer->pixels = temp;
+}
+
+/* Script commands turn into events once they are due */
+void canopy_pump_events(void)
+{
+    canopy__run_script();
+}
+void canopy_post_empty_event(void)
+{
+    // Waits check the queue every CANOPY_IDLE_WAIT_NS, nothing to wake up
+}
+
+/* Without a script nothing ever arrives, idle waits sleep this long so the
+ * loop still runs now and then without spinning */
+#define CANOPY_IDLE_WAIT_NS 10000000ull
+
+static bool canopy__events_pending(void)
+{
+    canopy_event_stats stats;
+    canopy_get_event_stats(&stats);
+    return stats.polled + stats.coalesced < stats.pushed;
+}
+
+/* Sleeps until the deadline in short steps, returning early once events
+ * are queued, pushed by another thread or left unpolled */
+static void canopy__wait_until(uint64_t deadline_ns)
+{
+    for (uint64_t now = canopy_get_time_ns();
+         now < deadline_ns && !canopy__events_pending();
+         now = canopy_get_time_ns()) {
+        uint64_t step = now + CANOPY_IDLE_WAIT_NS;
+        canopy__sleep_until(step < deadline_ns ? step : deadline_ns);
+    }
+}
+
+void canopy_wait_events(void)
+{
+    // The script is the only source of input, sleep until it has some
+    uint64_t deadline = canopy_get_time_ns() + CANOPY_IDLE_WAIT_NS;
+    if (headless.script) deadline = headless.due_ns;
+
+    canopy__wait_until(deadline);
+    canopy_pump_events();
+}
+void canopy_wait_events_timeout(double timeout_seconds)
+{
+    uint64_t deadline = canopy_get_time_ns() + (uint64_t)(timeout_seconds * 1e9);
+    if (headless.script && headless.due_ns < deadline) {
+        deadline = headless.due_ns;
+    }
+
+    canopy__wait_until(deadline);
+    canopy_pump_events();
+}
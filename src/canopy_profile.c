@@ -0,0 +1,253 @@
+#include "canopy_profile.h"
+
+#include <string.h>
+#include <blackbox.h>
+
+#if defined(CANOPY_PROFILE)
+
+_Static_assert((CANOPY_PROFILE_RING_SIZE & (CANOPY_PROFILE_RING_SIZE - 1)) == 0,
+               "CANOPY_PROFILE_RING_SIZE must be a power of two");
+
+/* Log-linear buckets: exact below 8ns, then 8 buckets per power of two,
+ * so a bucket spans at most an eighth of its lower bound */
+#define SUB_BITS    3
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define NUM_BUCKETS ((64 - SUB_BITS + 1) * SUB_BUCKETS)
+
+typedef struct {
+    const char *name;
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint32_t buckets[NUM_BUCKETS];
+} canopy__phase;
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    int phase;
+    bool instant;
+} canopy__sample;
+
+static struct {
+    canopy__phase phases[CANOPY_PROFILE_MAX_PHASES];
+    int phase_count;
+
+    canopy__sample ring[CANOPY_PROFILE_RING_SIZE];
+    uint64_t recorded;          // samples ever written to the ring
+} profile;
+
+static int canopy__bucket(uint64_t ns)
+{
+    if (ns < SUB_BUCKETS) return (int)ns;
+
+    int exp = 63 - __builtin_clzll(ns);     // at least SUB_BITS
+    int sub = (int)(ns >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (exp - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+// Highest value that lands in the bucket
+static uint64_t canopy__bucket_top(int bucket)
+{
+    if (bucket < SUB_BUCKETS) return (uint64_t)bucket;
+
+    int exp = bucket / SUB_BUCKETS + SUB_BITS - 1;
+    int sub = bucket % SUB_BUCKETS;
+    uint64_t low = (uint64_t)(SUB_BUCKETS + sub) << (exp - SUB_BITS);
+    return low + ((uint64_t)1 << (exp - SUB_BITS)) - 1;
+}
+
+/* Call sites pass the same literal every time, so the pointer almost
+ * always matches before the string compare is needed */
+static int canopy__find_phase(const char *name)
+{
+    for (int i = 0; i < profile.phase_count; i++) {
+        if (profile.phases[i].name == name) return i;
+    }
+    for (int i = 0; i < profile.phase_count; i++) {
+        if (strcmp(profile.phases[i].name, name) == 0) return i;
+    }
+
+    if (profile.phase_count == CANOPY_PROFILE_MAX_PHASES) return -1;
+
+    canopy__phase *p = &profile.phases[profile.phase_count];
+    memset(p, 0, sizeof(*p));
+    p->name   = name;
+    p->min_ns = UINT64_MAX;
+    return profile.phase_count++;
+}
+
+void canopy_profile_record(const char *name, uint64_t start_ns, uint64_t end_ns)
+{
+    int index = canopy__find_phase(name);
+    if (index < 0) return;
+
+    uint64_t ns = end_ns > start_ns ? end_ns - start_ns : 0;
+
+    canopy__phase *p = &profile.phases[index];
+    p->count++;
+    p->total_ns += ns;
+    if (ns < p->min_ns) p->min_ns = ns;
+    if (ns > p->max_ns) p->max_ns = ns;
+    p->buckets[canopy__bucket(ns)]++;
+
+    profile.ring[profile.recorded++ & (CANOPY_PROFILE_RING_SIZE - 1)] =
+        (canopy__sample){ start_ns, end_ns, index, false };
+}
+
+void canopy_profile_instant(const char *name, uint64_t time_ns)
+{
+    // Gets a phase slot for its name, but no statistics
+    int index = canopy__find_phase(name);
+    if (index < 0) return;
+
+    profile.ring[profile.recorded++ & (CANOPY_PROFILE_RING_SIZE - 1)] =
+        (canopy__sample){ time_ns, time_ns, index, true };
+}
+
+static uint64_t canopy__percentile(const canopy__phase *p, double fraction)
+{
+    uint64_t rank = (uint64_t)(fraction * (double)(p->count - 1)) + 1;
+    uint64_t seen = 0;
+
+    for (int b = 0; b < NUM_BUCKETS; b++) {
+        seen += p->buckets[b];
+        if (seen >= rank) {
+            uint64_t top = canopy__bucket_top(b);
+            return top < p->max_ns ? top : p->max_ns;
+        }
+    }
+    return p->max_ns;
+}
+
+void canopy_profile_dump(FILE *out)
+{
+    if (!out) return;
+
+    uint64_t kept = profile.recorded < CANOPY_PROFILE_RING_SIZE ?
+                    profile.recorded : CANOPY_PROFILE_RING_SIZE;
+    fprintf(out, "%-16s %8s %10s %10s %10s %10s %10s  (us, %llu recent samples kept)\n",
+            "phase", "count", "min", "avg", "p50", "p99", "max",
+            (unsigned long long)kept);
+
+    for (int i = 0; i < profile.phase_count; i++) {
+        const canopy__phase *p = &profile.phases[i];
+        if (p->count == 0) continue;
+
+        fprintf(out, "%-16s %8llu %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+                p->name, (unsigned long long)p->count,
+                p->min_ns / 1e3,
+                (double)p->total_ns / (double)p->count / 1e3,
+                canopy__percentile(p, 0.50) / 1e3,
+                canopy__percentile(p, 0.99) / 1e3,
+                p->max_ns / 1e3);
+    }
+    fflush(out);
+}
+
+// Quotes a name, names passed to canopy_profile_record can be any string
+static void canopy__write_json_string(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for (const unsigned char *c = (const unsigned char *)str; *c; c++) {
+        if (*c == '"' || *c == '\\') fprintf(file, "\\%c", *c);
+        else if (*c < 0x20)          fprintf(file, "\\u%04x", *c);
+        else                         fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+/* Samples are in the order they ended, trace viewers sort by start. Times
+ * are microseconds from the oldest kept sample */
+bool canopy_profile_write_trace(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        ERROR("Could not open trace file: %s", path);
+        return false;
+    }
+
+    uint64_t first = profile.recorded > CANOPY_PROFILE_RING_SIZE ?
+                     profile.recorded - CANOPY_PROFILE_RING_SIZE : 0;
+
+    uint64_t origin = UINT64_MAX;
+    for (uint64_t i = first; i < profile.recorded; i++) {
+        uint64_t start = profile.ring[i & (CANOPY_PROFILE_RING_SIZE - 1)].start_ns;
+        if (start < origin) origin = start;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (uint64_t i = first; i < profile.recorded; i++) {
+        const canopy__sample *s = &profile.ring[i & (CANOPY_PROFILE_RING_SIZE - 1)];
+        const char *sep = i + 1 < profile.recorded ? "," : "";
+        double ts = (double)(s->start_ns - origin) / 1e3;
+
+        fputs("{\"name\":", file);
+        canopy__write_json_string(file, profile.phases[s->phase].name);
+        if (s->instant) {
+            fprintf(file, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,"
+                          "\"pid\":1,\"tid\":1}%s\n", ts, sep);
+        } else {
+            fprintf(file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                          "\"pid\":1,\"tid\":1}%s\n",
+                    ts, (double)(s->end_ns - s->start_ns) / 1e3, sep);
+        }
+    }
+    fprintf(file, "]}\n");
+
+    bool ok = !ferror(file);
+    fclose(file);
+
+    if (ok) INFO("Wrote %llu trace events to %s",
+                 (unsigned long long)(profile.recorded - first), path);
+    else ERROR("Failed writing trace file: %s", path);
+    return ok;
+}
+
+void canopy_profile_reset(void)
+{
+    profile.phase_count = 0;
+    profile.recorded    = 0;
+}
+
+#else // Compiled out
+
+void canopy_profile_record(const char *name, uint64_t start_ns, uint64_t end_ns)
+{
+    (void)name; (void)start_ns; (void)end_ns;
+}
+
+void canopy_profile_dump(FILE *out)
+{
+    if (out) fprintf(out, "Profiling is compiled out, build with CANOPY_PROFILE\n");
+}
+
+void canopy_profile_instant(const char *name, uint64_t time_ns)
+{
+    (void)name; (void)time_ns;
+}
+
+bool canopy_profile_write_trace(const char *path)
+{
+    WARN("Profiling is compiled out, no trace written to %s", path);
+    return false;
+}
+
+void canopy_profile_reset(void) {}
+
+#endif
+
+bool canopy_profile_dump_file(const char *path)
+{
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        ERROR("Could not open profile file: %s", path);
+        return false;
+    }
+
+    canopy_profile_dump(file);
+    fclose(file);
+    INFO("Wrote profile to %s", path);
+    return true;
+}
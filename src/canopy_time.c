@@ -1,13 +1,20 @@
 #include "canopy_time.h"
 
+#if defined(__APPLE__)
 #include <mach/mach_time.h>
+#else
+#include <time.h>      // clock_gettime, clock_nanosleep
+#include <errno.h>
+#endif
 #include <inttypes.h>  // For PRIu64
 #include <blackbox.h>
 
 #define DEFAULT_FPS 60
 
 static struct {
+#if defined(__APPLE__)
     mach_timebase_info_data_t timebase;
+#endif
     double to_seconds;
 
     double target_frame_time;     // Time between frames (in seconds)
@@ -17,6 +24,7 @@ static struct {
 
 void canopy_init_timer(void)
 {
+#if defined(__APPLE__)
     kern_return_t result = mach_timebase_info(&canopy_timer.timebase);
 
     if (result != KERN_SUCCESS) {
@@ -26,6 +34,10 @@ void canopy_init_timer(void)
 
     canopy_timer.to_seconds = ((double)canopy_timer.timebase.numer /
                                (double)canopy_timer.timebase.denom) / 1e9;
+#else
+    // The monotonic clock already counts in nanoseconds
+    canopy_timer.to_seconds = 1e-9;
+#endif
 
     canopy_timer.target_frame_time = 1.f / DEFAULT_FPS;  // Default to 60 FPS
     canopy_timer.last_frame_time = canopy_get_time();  // Initialize clock
@@ -35,9 +47,22 @@ void canopy_init_timer(void)
     TRACE("Default target frame time: %.6f seconds, %d FPS", canopy_timer.target_frame_time, DEFAULT_FPS);
 }
 
+#if !defined(__APPLE__)
+static uint64_t canopy__monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+#endif
+
 double canopy_get_time(void)
 {
+#if defined(__APPLE__)
     uint64_t ticks = mach_absolute_time();
+#else
+    uint64_t ticks = canopy__monotonic_ns();
+#endif
     double seconds = (double)ticks * canopy_timer.to_seconds;
 
     //TRACE("Get time: %.6f seconds", seconds);
@@ -46,8 +71,15 @@ double canopy_get_time(void)
 
 uint64_t canopy_get_time_ns(void)
 {
+#if defined(__APPLE__)
+    // Events are stamped with this, they can come before canopy_init_timer
+    if (canopy_timer.timebase.denom == 0) mach_timebase_info(&canopy_timer.timebase);
+
     uint64_t ticks = mach_absolute_time();
     uint64_t ns = ticks * canopy_timer.timebase.numer / canopy_timer.timebase.denom;
+#else
+    uint64_t ns = canopy__monotonic_ns();
+#endif
 
    // TRACE("Get time: %" PRIu64 " nanoseconds", ns);
     return ns;
@@ -95,12 +127,25 @@ int canopy_should_render_frame(void)
 
 void canopy_sleep_until_next_frame(void)
 {
+#if defined(__APPLE__)
     uint64_t now = mach_absolute_time();
+#else
+    uint64_t now = canopy__monotonic_ns();
+#endif
     double elapsed = (now * canopy_timer.to_seconds) - canopy_timer.last_frame_time;
     double remaining = canopy_timer.target_frame_time - elapsed;
 
     if (remaining > 0) {
         uint64_t wait_until = now + (uint64_t)(remaining / canopy_timer.to_seconds);
+#if defined(__APPLE__)
         mach_wait_until(wait_until);
+#else
+        // Absolute deadline, so a signal only resumes the same sleep
+        struct timespec ts = {
+            .tv_sec  = (time_t)(wait_until / 1000000000ull),
+            .tv_nsec = (long)(wait_until % 1000000000ull),
+        };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#endif
     }
 }
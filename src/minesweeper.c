@@ -1,25 +1,37 @@
+#include <time.h>
+#include <limits.h>
 #include <blackbox.h>
 
+#include "board.h"
 #include "canopy.h"
 #include "picasso.h"
 
-#define foreach_cell(body) do {                 \
-    for (int col = 0; col < COL; col++) {       \
-        for (int row = 0; row < ROW; row++) {   \
-            cell *cell = &grid[col][row];       \
-            do{ body } while(0);                \
-        }}} while(0);
-
-#define ROW 16
-#define COL 16
-#define GRIDSIZE 16
+#define DEFAULT_WIDTH 16
+#define DEFAULT_HEIGHT 16
+#define DEFAULT_BOMBS 40
 #define CELL_SIZE 24
 #define TILE_SIZE 16
 #define WINDOW_HEIGHT 492
 #define WINDOW_WIDTH 426
-#define BOMB_CHANCE 6
 #define CANVAS_X 21
 #define CANVAS_Y 87
+// The sunken canvas in background.bmp fits 16x16 cells at CELL_SIZE,
+// larger boards scroll inside it
+#define VIEW_COLS 16
+#define VIEW_ROWS 16
+#define CANVAS_WIDTH  (VIEW_COLS * CELL_SIZE)
+#define CANVAS_HEIGHT (VIEW_ROWS * CELL_SIZE)
+// Zoom range of the scroll wheel, in pixels per cell. Tiles are drawn down
+// to MIN_CELL_SIZE, further out the board is shaded by how much of it is
+// revealed or flagged, down to a pixel per chunk of cells
+#define MIN_CELL_SIZE 8
+#define MAX_CELL_SIZE 64
+#define ZOOM_STEP 4
+#define OVERVIEW_HIDDEN   ((color){0xC0, 0xC0, 0xC0, 0xFF})
+#define OVERVIEW_REVEALED ((color){0x80, 0x80, 0x80, 0xFF})
+#define OVERVIEW_FLAGGED  ((color){0xFF, 0x00, 0x00, 0xFF})
+// Pixels a left drag moves before it pans instead of pressing
+#define DRAG_SLOP 4
 
 typedef enum {
     GAME_OVER,
@@ -84,44 +96,195 @@ typedef enum {
     FACE_DEAD,
 } tile_type;
 
+// Where each atlas starts in the sprite table, and how many sprites it has
+#define TILE_SPRITES    0
+#define TILE_COUNT      16
+#define DIGIT_SPRITES   16
+#define DIGIT_COUNT     12
+#define FACE_SPRITES    FACE_NORMAL
+#define FACE_COUNT      5
+
 typedef struct {
     picasso_rect src;
     picasso_rect dst;
     tile_type tile;
 } rect;
 
+/* The tile currently held down by the mouse, drawn as pressed */
+static int held_x = -1;
+static int held_y = -1;
+
+// Tile blits are recorded, then drawn in bands by the rasterizer threads
+static picasso_rasterizer *rasterizer;
+static picasso_command_list *tile_commands;
+
+// Tiles of the current draw_canvas, recorded as sprite batches
+#define TILE_BATCH 1024
+static picasso_sprite tile_sprites[TILE_BATCH];
+static int tile_count;
+
+/* The part of the board shown in the canvas. The board is laid out at
+ * cell_size pixels per cell, or zoomed out further at 1 << shift cells a
+ * side per pixel, and the canvas corner shows board pixel (x, y). Drawing
+ * and hit testing both go through it */
 typedef struct {
-    bool is_bomb;
-    bool is_revealed;
-    bool is_flagged;
-    bool is_question;
-    bool is_pressed;
-    rect draw;
-    int close_bombs;
-} cell;
+    int cell_size;
+    int shift;          // only above 0 with a cell_size of 1
+    int64_t x, y;
+} viewport;
+
+static viewport view = { CELL_SIZE, 0, 0, 0 };
+
+/* Every sprite scaled once to the size it is drawn at, rebuilt when the
+ * atlas or that size changes */
+static picasso_sprite_cache tile_cache;
+static picasso_sprite_cache digit_cache;
+static picasso_sprite_cache face_cache;
+
+static bool cache_sprites(picasso_sprite_cache *cache, picasso_texture *atlas,
+        int first, int count, int src_width, int src_height,
+        int width, int height)
+{
+    picasso_rect sources[TILE_COUNT];
+    for (int i = 0; i < count; i++)
+        sources[i] = (picasso_rect){ sprites[first + i].x, sprites[first + i].y,
+                                     src_width, src_height };
+
+    return picasso_update_sprite_cache(cache, atlas, sources, count, width, height);
+}
+
+// Pixels taken by a number of cells at the current zoom, rounded up
+static int64_t view_pixels(int64_t cells)
+{
+    return (cells * view.cell_size + (1 << view.shift) - 1) >> view.shift;
+}
+
+// Whether the board at the current zoom is larger than the canvas
+static bool view_scrolls(board *b)
+{
+    return view_pixels(b->width) > CANVAS_WIDTH || view_pixels(b->height) > CANVAS_HEIGHT;
+}
+
+/* Moves the view, kept on the board. A board smaller than the canvas sits
+ * in its top left corner */
+static void move_view(board *b, int64_t x, int64_t y)
+{
+    int64_t max_x = PICASSO_MAX(view_pixels(b->width)  - CANVAS_WIDTH,  0);
+    int64_t max_y = PICASSO_MAX(view_pixels(b->height) - CANVAS_HEIGHT, 0);
+
+    view.x = PICASSO_CLAMP(x, 0, max_x);
+    view.y = PICASSO_CLAMP(y, 0, max_y);
+}
+
+/* Zooms in or out by steps, keeping the board under canvas point (cx, cy).
+ * Tile sizes go by ZOOM_STEP, smaller sizes halve down to a pixel per cell
+ * and then pixels double the cells they cover, until the board fits */
+static void zoom_view(board *b, int steps, int cx, int cy)
+{
+    // Board position under the point, in cells
+    double bx = (double)(view.x + cx) * (1 << view.shift) / view.cell_size;
+    double by = (double)(view.y + cy) * (1 << view.shift) / view.cell_size;
+
+    for (; steps > 0; steps--) {
+        if (view.shift > 0)
+            view.shift--;
+        else if (view.cell_size < MIN_CELL_SIZE)
+            view.cell_size *= 2;
+        else
+            view.cell_size = PICASSO_MIN(view.cell_size + ZOOM_STEP, MAX_CELL_SIZE);
+    }
+    for (; steps < 0; steps++) {
+        if (view.cell_size > MIN_CELL_SIZE)
+            view.cell_size = PICASSO_MAX(view.cell_size - ZOOM_STEP, MIN_CELL_SIZE);
+        else if (!view_scrolls(b))
+            break;
+        else if (view.cell_size > 1)
+            view.cell_size /= 2;
+        else
+            view.shift++;
+    }
+
+    move_view(b, (int64_t)(bx * view.cell_size / (1 << view.shift)) - cx,
+                 (int64_t)(by * view.cell_size / (1 << view.shift)) - cy);
+}
+
+// Whether a window position is on the canvas, board or not
+static bool on_canvas(int mouse_x, int mouse_y)
+{
+    return mouse_x >= CANVAS_X && mouse_x < CANVAS_X + CANVAS_WIDTH &&
+           mouse_y >= CANVAS_Y && mouse_y < CANVAS_Y + CANVAS_HEIGHT;
+}
+
+/* The cell under a window position, false outside the canvas or the
+ * board, or when a pixel covers several cells. The inverse of where
+ * draw_canvas puts the tiles */
+static bool cell_at(board *b, int mouse_x, int mouse_y, int *cell_x, int *cell_y)
+{
+    *cell_x = *cell_y = -1;
+    if (!on_canvas(mouse_x, mouse_y) || view.shift > 0) return false;
+
+    int64_t x = (view.x + mouse_x - CANVAS_X) / view.cell_size;
+    int64_t y = (view.y + mouse_y - CANVAS_Y) / view.cell_size;
+    if (x >= b->width || y >= b->height) return false;
+
+    *cell_x = (int)x;
+    *cell_y = (int)y;
+    return true;
+}
+
+/* Moves the pressed look to another tile, -1 for none. Both tiles are
+ * redrawn */
+static void hold_tile(board *b, int x, int y)
+{
+    board_mark_dirty(b, held_x, held_y);
+    held_x = x;
+    held_y = y;
+    board_mark_dirty(b, held_x, held_y);
+}
 
 // API forward declared
-void check_status(cell grid[COL][ROW], game_state *state);
-void process_input(canopy_window *w, cell grid[COL][ROW], rect *face,
-                   game_state *state, int *bomb_count);
-void draw_face(picasso_backbuffer *renderer, picasso_image *texture,
+void check_status(board *b, game_state *state);
+void process_input(canopy_window *w, board *b, rect *face,
+                   game_state *state);
+bool draw_face(picasso_backbuffer *renderer, picasso_texture *texture,
                rect *face, game_state *state);
-void draw_numbers(picasso_backbuffer *renderer, picasso_image *texture,
+bool draw_numbers(picasso_backbuffer *renderer, picasso_texture *texture,
                   int *number_of_bombs, int last_second);
-void draw_canvas(picasso_backbuffer *renderer, cell grid[COL][ROW],
-                 picasso_image *texture, sprite *sprites, game_state state);
-tile_type select_tile_for_cell(cell *c, game_state state);
-void reveal_tiles(cell grid[COL][ROW], int x, int y);
-void init_cell(cell *cell, int row, int col);
-void init_grid(cell grid[COL][ROW], int *num_bombs);
-int count_neighboring_bombs(cell grid[COL][ROW], int x, int y);
-
-int main(void)
+bool draw_canvas(picasso_backbuffer *renderer, picasso_backbuffer *background,
+                 board *b, picasso_texture *texture, game_state state);
+tile_type select_tile_for_cell(cell c, bool is_pressed, game_state state);
+void present_damage(canopy_window *window, picasso_backbuffer *renderer);
+
+int main(int argc, char **argv)
 {
     // Initialization
     //--------------------------------------------------------------------------
     init_log(LOG_DEFAULT);
 
+    // Usage: minesweeper [width height bombs [seed]]
+    int width     = DEFAULT_WIDTH;
+    int height    = DEFAULT_HEIGHT;
+    int bombs     = DEFAULT_BOMBS;
+    uint64_t seed = (uint64_t)time(NULL);
+    if (argc == 4 || argc == 5) {
+        width  = atoi(argv[1]);
+        height = atoi(argv[2]);
+        bombs  = atoi(argv[3]);
+        if (argc == 5) seed = strtoull(argv[4], NULL, 0);
+    } else if (argc != 1) {
+        WARN("Usage: %s [width height bombs [seed]], using defaults", argv[0]);
+    }
+
+    board *grid = board_create(width, height, bombs, seed);
+    if (!grid) {
+        FATAL("Could not create a %dx%d board with %d bombs",
+              width, height, bombs);
+        shutdown_log();
+        return 1;
+    }
+    INFO("Created %dx%d board with %d bombs, seed %llu",
+         width, height, bombs, (unsigned long long)seed);
+
     canopy_window* window = canopy_create_window("Minesweeper",
             WINDOW_WIDTH,
             WINDOW_HEIGHT,
@@ -131,27 +294,37 @@ int main(void)
 
     picasso_backbuffer *renderer = picasso_create_backbuffer(WINDOW_WIDTH,
                                                              WINDOW_HEIGHT);
-    picasso_image *background = picasso_load_bmp("img/Sprites/background.bmp");
-    picasso_image *numbers    = picasso_load_bmp("img/Sprites/numbers.bmp");
-    picasso_image *tiles      = picasso_load_bmp("img/Sprites/tiles.bmp");
-    picasso_image *faces      = picasso_load_bmp("img/Sprites/faces.bmp");
-
-    cell grid[COL][ROW];
+    CANOPY_PROFILE_BEGIN(load_assets);
+    picasso_texture *background = picasso_load_texture("img/Sprites/background.bmp");
+    picasso_texture *numbers    = picasso_load_texture("img/Sprites/numbers.bmp");
+    picasso_texture *tiles      = picasso_load_texture("img/Sprites/tiles.bmp");
+    picasso_texture *faces      = picasso_load_texture("img/Sprites/faces.bmp");
+
+    /* The background never changes, so it is scaled to the window once
+     * and every frame starts from a copy of it */
+    picasso_backbuffer *background_layer = picasso_create_layer(WINDOW_WIDTH,
+                                                                WINDOW_HEIGHT);
+    picasso_blit_texture(background_layer, background,
+            (picasso_rect){0, 0, background->width, background->height},
+            (picasso_rect){0, 0, WINDOW_WIDTH, WINDOW_HEIGHT});
+    picasso_free_texture(background);
+    CANOPY_PROFILE_END(load_assets);
+
+    /* The renderer keeps its contents between frames and only what changed
+     * is drawn over it. draw_canvas fills the canvas part */
+    picasso_rect canvas = { CANVAS_X, CANVAS_Y, CANVAS_WIDTH, CANVAS_HEIGHT };
+    picasso_draw_layer(renderer, background_layer, &canvas);
+
+    rasterizer    = picasso_create_rasterizer(0);
+    tile_commands = picasso_create_command_list();
 
     // Initializing the time keeping
     canopy_init_timer();
-    canopy_set_fps(24);
 
-    double elapsed_seconds	= 0;
+    double game_start		= canopy_get_time();
     int last_second			= 0;
     bool timer_active		= true;
 
-    int number_of_bombs		= 0;
-    int bomb_count          = 0;
-
-    init_grid(grid, &number_of_bombs);
-    bomb_count              = number_of_bombs;
-
     // Initial animation state
     game_state state        = PLAYING;
     rect face               = { .tile = FACE_NORMAL };
@@ -160,10 +333,17 @@ int main(void)
     // Main Game Loop
     while(!canopy_window_should_close(window))
     {
+        CANOPY_PROFILE_BEGIN(frame);
+
         // Input
         //----------------------------------------------------------------------
+        CANOPY_PROFILE_BEGIN(input);
+        process_input(window, grid, &face, &state);
+        CANOPY_PROFILE_END(input);
+
+        CANOPY_PROFILE_BEGIN(status);
         check_status(grid, &state);
-        process_input(window, grid, &face, &state, &bomb_count);
+        CANOPY_PROFILE_END(status);
 
         if( state == GAME_OVER || state == RESTARTING || state == WON )
         {
@@ -171,58 +351,90 @@ int main(void)
         }
         if( timer_active )
         {
-            last_second = (int)elapsed_seconds;
+            last_second = (int)(canopy_get_time() - game_start);
         }
         if( state == RESTARTING )
         {
-            init_grid(grid, &number_of_bombs);
+            // Every new game moves on to the next seed
+            board_reset(grid, ++seed);
+            INFO("New game with seed %llu", (unsigned long long)seed);
 
             state           = PLAYING;
             last_second     = 0;
-            elapsed_seconds = 0;
+            game_start      = canopy_get_time();
             timer_active    = true;
-            bomb_count      = number_of_bombs;
         }
 
         // Draw
         //----------------------------------------------------------------------
-        if( canopy_should_render_frame() )
-        {
-            elapsed_seconds += canopy_get_delta_time();
+        /*Draw the things that changed*/
+        int bomb_count = board_bombs_left(grid);
 
-            picasso_clear_backbuffer(renderer);
+        CANOPY_PROFILE_BEGIN(draw_numbers);
+        bool changed = draw_numbers(renderer, numbers, &bomb_count, last_second);
+        CANOPY_PROFILE_END(draw_numbers);
 
-            /*Create the static background*/
-            picasso_blit_rect(renderer,background,
-                    (picasso_rect){0,0,
-                    background->width, background->height},
-                    (picasso_rect){0,0,
-                    WINDOW_WIDTH, WINDOW_HEIGHT});
+        CANOPY_PROFILE_BEGIN(draw_face);
+        changed     |= draw_face(renderer, faces, &face, &state);
+        CANOPY_PROFILE_END(draw_face);
 
-            /*Draw the things that is dynamic*/
-            draw_numbers(renderer, numbers, &bomb_count, last_second);
-            draw_face(renderer, faces, &face, &state);
-            draw_canvas(renderer, grid, tiles, sprites, state);
+        CANOPY_PROFILE_BEGIN(draw_canvas);
+        changed     |= draw_canvas(renderer, background_layer, grid, tiles, state);
+        CANOPY_PROFILE_END(draw_canvas);
+
+        /* Present the regions the draw calls touched */
+        if( changed )
+        {
+            CANOPY_PROFILE_BEGIN(present);
+            present_damage(window, renderer);
+            CANOPY_PROFILE_END(present);
+        }
 
-            /* Present */
-            canopy_swap_backbuffer(window, (framebuffer*)renderer);
-            canopy_present_buffer(window);
+        CANOPY_PROFILE_END(frame);
 
-            if( state == GAME_OVER ) canopy_wait_events();
+        // Wait
+        //----------------------------------------------------------------------
+        /* Nothing changes on screen without input, except the timer once a
+         * second, so sleep until either comes along */
+        if( timer_active )
+        {
+            double next_tick = game_start + last_second + 1;
+            canopy_wait_events_timeout(PICASSO_MAX(next_tick - canopy_get_time(), 0.0));
         } else {
-            canopy_sleep_until_next_frame();
+            canopy_wait_events();
         }
         //----------------------------------------------------------------------
     }
 
     // De-Initialization
     //--------------------------------------------------------------------------
-    picasso_free_image(numbers);
-    picasso_free_image(tiles);
-    picasso_free_image(faces);
-    picasso_free_image(background);
+    const char *profile_path = getenv("CANOPY_PROFILE_FILE");
+    if (profile_path) canopy_profile_dump_file(profile_path);
+    const char *trace_path = getenv("CANOPY_TRACE_FILE");
+    if (trace_path) canopy_profile_write_trace(trace_path);
+
+    canopy_event_stats events;
+    canopy_get_event_stats(&events);
+    DEBUG("Events: %llu polled, %llu coalesced, %llu dropped, "
+          "latency avg %.3f ms max %.3f ms",
+          (unsigned long long)events.polled,
+          (unsigned long long)events.coalesced,
+          (unsigned long long)events.dropped,
+          events.polled ? events.total_latency_ns / 1e6 / events.polled : 0.0,
+          events.max_latency_ns / 1e6);
+
+    picasso_free_sprite_cache(&digit_cache);
+    picasso_free_sprite_cache(&tile_cache);
+    picasso_free_sprite_cache(&face_cache);
+    picasso_free_texture(numbers);
+    picasso_free_texture(tiles);
+    picasso_free_texture(faces);
+    picasso_destroy_backbuffer(background_layer);
     picasso_destroy_backbuffer(renderer);
+    picasso_destroy_command_list(tile_commands);
+    picasso_destroy_rasterizer(rasterizer);
     canopy_free_window(window);
+    board_destroy(grid);
 
     shutdown_log();
     //--------------------------------------------------------------------------
@@ -235,151 +447,305 @@ int main(void)
 // Implementation of functions
 //------------------------------------------------------------------------------
 
-void check_status(cell grid[COL][ROW], game_state *state)
+/* Copies the damaged regions of the renderer to the window. The renderer
+ * keeps its pixels, so later frames only draw over what changed */
+void present_damage(canopy_window *window, picasso_backbuffer *renderer)
 {
-    /* Checking every mine - if it is a bomb and not revealed - return.
-     *
-     * If every tile that is not a bomb is revealed the state is won */
+    const picasso_rect *damage;
+    int count = picasso_get_damage(renderer, &damage);
 
-    foreach_cell({
-            if (!cell->is_bomb && !cell->is_revealed)
-            return;
-            });
-
-    if (*state == PLAYING) *state = WON;
-}
-
-void init_cell(cell *cell, int row, int col)
-{
-    cell->close_bombs = 0;
-    cell->draw.tile = TILE_NORMAL;
-    cell->is_flagged = false;
-    cell->is_bomb = (arc4random() % BOMB_CHANCE == 0);
-    cell->is_revealed = false;
-    cell->is_pressed = false;
-    cell->is_question = false;
-    cell->draw.src.width = TILE_SIZE;
-    cell->draw.src.height = TILE_SIZE;
-    cell->draw.dst.x = row * CELL_SIZE + CANVAS_X;
-    cell->draw.dst.y = col * CELL_SIZE + CANVAS_Y;
-    cell->draw.dst.width = CELL_SIZE;
-    cell->draw.dst.height = CELL_SIZE;
-}
-
-int count_neighboring_bombs(cell grid[COL][ROW], int x, int y)
-{
-    int bomb_count = 0;
-
-    for( int i = -1; i <= 1; i++ ) {
-        for( int j = -1; j <= 1; j++ ){
-            int nx = x + i;
-            int ny = y + j;
-
-            // Check if neighbor is within grid bounds
-            if( nx >= 0 && nx < GRIDSIZE && ny >= 0 && ny < GRIDSIZE ){
-                // Check if neighbor is a bomb
-                if( grid[ny][nx].is_bomb ) bomb_count++;
-
-            }
-        }
+    canopy_rect rects[PICASSO_MAX_DAMAGE];
+    for (int i = 0; i < count; i++) {
+        rects[i] = (canopy_rect){ damage[i].x, damage[i].y,
+                                  damage[i].width, damage[i].height };
     }
-    return bomb_count;
-}
 
-void init_grid(cell grid[COL][ROW], int *num_bombs)
-{
-    INFO("Grid initialized");
-    *num_bombs = 0;
-
-    foreach_cell({
-            init_cell( cell, row, col );
-            if( cell->is_bomb == true ) (*num_bombs)++;
-            });
-    foreach_cell({
-            if( !cell->is_bomb )
-            cell->close_bombs = count_neighboring_bombs(grid, row, col);
-            });
-
-    TRACE("Counted bombs, total amount is %d", *num_bombs);
+    framebuffer frame = {
+        .pixels = renderer->pixels,
+        .width  = (int)renderer->width,
+        .height = (int)renderer->height,
+        .pitch  = (int)renderer->pitch * CANOPY_BYTES_PER_PIXEL,
+    };
+    canopy_present_damage(window, &frame, rects, count);
+    picasso_clear_damage(renderer);
 }
 
-void reveal_tiles(cell grid[COL][ROW], int x, int y)
+void check_status(board *b, game_state *state)
 {
-    // Check if the tile coordinates are within the (*grid) bounds
-    if( x < 0 || x >= GRIDSIZE || y < 0 || y >= GRIDSIZE )
-        return;
-
-    // Check if the tile is already revealed or is a bomb
-    if( grid[y][x].is_revealed || grid[y][x].is_bomb || grid[y][x].is_flagged )
-        return;
-
-    // Reveal this tile
-    grid[y][x].is_revealed = true;
-
-    // If the tile is not blank (has neighboring bombs), stop recursion
-    if( grid[y][x].close_bombs > 0 )
-        return;
-
-    // Recursively reveal adjacent tiles
-    for( int i = -1; i <= 1; i++ ){
-        for( int j = -1; j <= 1; j++ ){
-            // Avoid the current tile itself
-            if( i != 0 || j != 0 ) reveal_tiles(grid, x + i, y + j);
-        }
+    // The board decides wins and losses, the game only shows them
+    if (*state != PLAYING) return;
+
+    switch (board_get_status(b)) {
+        case BOARD_WON:  *state = WON;       break;
+        case BOARD_LOST:
+            // Game over uncovers the bombs and crosses out wrong flags
+            *state = GAME_OVER;
+            board_mark_all_dirty(b);
+            break;
+        default: break;
     }
 }
 
-tile_type select_tile_for_cell(cell *c, game_state state)
+tile_type select_tile_for_cell(cell c, bool is_pressed, game_state state)
 {
+    bool is_bomb     = c & CELL_BOMB;
+    bool is_revealed = c & CELL_REVEALED;
+    bool is_flagged  = c & CELL_FLAGGED;
+    bool is_question = c & CELL_QUESTION;
+
     // --- Game over: bombs and mistakes ---
     if (state == GAME_OVER) {
-        if (c->is_bomb && c->is_revealed)   return BOMB_RED;
-        if (c->is_bomb && !c->is_flagged)   return BOMB_NORMAL;
-        if (c->is_flagged && !c->is_bomb)   return BOMB_CROSS;
-        if (c->is_flagged)                  return TILE_FLAG;
+        if (is_bomb && is_revealed)     return BOMB_RED;
+        if (is_bomb && !is_flagged)     return BOMB_NORMAL;
+        if (is_flagged && !is_bomb)     return BOMB_CROSS;
+        if (is_flagged)                 return TILE_FLAG;
     }
 
     // --- Flags and question marks ---
-    if (c->is_flagged && !c->is_revealed)
+    if (is_flagged && !is_revealed)
         return TILE_FLAG;
 
-    if (c->is_question && !c->is_revealed && c->is_pressed)
+    if (is_question && !is_revealed && is_pressed)
         return TILE_QUESTION_PRESSED;
 
-    if (c->is_question && !c->is_revealed)
+    if (is_question && !is_revealed)
         return TILE_QUESTION;
 
     // --- Revealed tile: show number ---
-    if (c->is_revealed && !c->is_bomb)
-        return c->close_bombs;
+    if (is_revealed && !is_bomb)
+        return c & CELL_COUNT;
 
     // --- Pressed tile (but not revealed) ---
-    if (c->is_pressed)
+    if (is_pressed)
         return TILE_PRESSED;
 
     // --- Default: hidden tile ---
     return TILE_NORMAL;
 }
 
-void draw_canvas(picasso_backbuffer *renderer, cell grid[COL][ROW],
-        picasso_image *texture, sprite *sprites, game_state state)
+/* Records the tiles gathered so far as one batch out of the tile cache.
+ * Tiles are placed from the first visible cell, the batch offset scrolls
+ * them by the part of it outside the canvas */
+static void submit_tiles(void)
+{
+    if (tile_count == 0) return;
+
+    picasso_cmd_blit_batch(tile_commands, &(picasso_sprite_batch){
+        .atlas      = tile_cache.texture,
+        .src_width  = view.cell_size, .src_height = view.cell_size,
+        .dst_width  = view.cell_size, .dst_height = view.cell_size,
+        .offset_x   = -(int)(view.x % view.cell_size),
+        .offset_y   = -(int)(view.y % view.cell_size),
+        .sprites    = tile_sprites,
+        .count      = tile_count,
+    });
+    tile_count = 0;
+}
+
+// Adds one tile to the batch, draw_canvas rasterizes them together
+static void draw_tile(board *b, game_state state, int x, int y)
+{
+    bool is_pressed = (x == held_x && y == held_y);
+    tile_type tile  = select_tile_for_cell(BOARD_CELL(b, x, y),
+                                           is_pressed, state);
+
+    // Dirty cells can repeat, so a full batch goes out early
+    if (tile_count == TILE_BATCH) submit_tiles();
+
+    int size = view.cell_size;
+    tile_sprites[tile_count++] = (picasso_sprite){
+        (tile - TILE_SPRITES) * size, 0,
+        (x - (int)(view.x / size)) * size, (y - (int)(view.y / size)) * size };
+}
+
+/* Draws the tiles the board has marked as changed, or every visible tile
+ * when too many changed. Only cells in the view are visited */
+static bool draw_tiles(picasso_backbuffer *canvas, board *b, game_state state)
+{
+    int size = view.cell_size;
+
+    // Visible cells, the last row and column may be cut by the canvas edge
+    int x0 = (int)(view.x / size);
+    int y0 = (int)(view.y / size);
+    int x1 = (int)PICASSO_MIN((int64_t)b->width,  (view.x + CANVAS_WIDTH  + size - 1) / size);
+    int y1 = (int)PICASSO_MIN((int64_t)b->height, (view.y + CANVAS_HEIGHT + size - 1) / size);
+
+    const uint32_t *dirty;
+    size_t count;
+    bool drawn = false;
+
+    if (board_get_dirty(b, &dirty, &count)) {
+        for (size_t i = 0; i < count; i++) {
+            int x = dirty[i] % b->width;
+            int y = dirty[i] / b->width;
+            if (x < x0 || x >= x1 || y < y0 || y >= y1) continue;
+
+            draw_tile(b, state, x, y);
+            drawn = true;
+        }
+    } else {
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++)
+                draw_tile(b, state, x, y);
+        drawn = true;
+    }
+
+    submit_tiles();
+    picasso_rasterize(rasterizer, canvas, tile_commands);
+    picasso_reset_command_list(tile_commands);
+    return drawn;
+}
+
+// Mixes the overview colors by how many of the cells are in each state
+static uint32_t shade_cells(uint64_t revealed, uint64_t flagged, uint64_t cells)
 {
-    foreach_cell({
-            cell->draw.tile = select_tile_for_cell(cell, state);
+    if (cells == 0) return color_to_u32(OVERVIEW_HIDDEN);
 
-            cell->draw.src.x = sprites[cell->draw.tile].x;
-            cell->draw.src.y = sprites[cell->draw.tile].y;
+    uint64_t hidden = cells - revealed - flagged;
+    color r = OVERVIEW_REVEALED, f = OVERVIEW_FLAGGED, h = OVERVIEW_HIDDEN;
 
-            picasso_blit_rect(renderer, texture, cell->draw.src, cell->draw.dst);
-            });
+    return color_to_u32(((color){
+        .r = (uint8_t)((r.r * revealed + f.r * flagged + h.r * hidden) / cells),
+        .g = (uint8_t)((r.g * revealed + f.g * flagged + h.g * hidden) / cells),
+        .b = (uint8_t)((r.b * revealed + f.b * flagged + h.b * hidden) / cells),
+        .a = 0xFF,
+    }));
 }
 
-void draw_numbers(picasso_backbuffer *renderer, picasso_image *texture,
+/* Shades every visible pixel of a board zoomed out past the tiles. A
+ * pixel of a few cells reads them, a pixel of a summary chunk or more
+ * reads the board summary of that size, so a frame costs the same at any
+ * zoom. Any change redraws the whole view */
+static bool draw_overview(picasso_backbuffer *canvas, board *b)
+{
+    const uint32_t *dirty;
+    size_t count;
+    if (board_get_dirty(b, &dirty, &count) && count == 0) return false;
+
+    int size  = view.cell_size;
+    int shift = view.shift;
+    int width  = (int)PICASSO_MIN(view_pixels(b->width),  (int64_t)CANVAS_WIDTH);
+    int height = (int)PICASSO_MIN(view_pixels(b->height), (int64_t)CANVAS_HEIGHT);
+
+    int cols = 0, rows = 0;
+    const board_summary *chunks = shift >= BOARD_CHUNK_SHIFT
+        ? board_get_summary(b, shift - BOARD_CHUNK_SHIFT, &cols, &rows) : NULL;
+
+    for (int py = 0; py < height; py++) {
+        uint32_t *row = &canvas->pixels[(size_t)py * canvas->pitch];
+        int64_t by    = view.y + py;
+
+        // Cells under the pixel, at least the one it is part of
+        int64_t y0 = (by << shift) / size;
+        int64_t y1 = PICASSO_MIN(PICASSO_MAX(((by + 1) << shift) / size, y0 + 1),
+                                 (int64_t)b->height);
+
+        for (int px = 0; px < width; px++) {
+            int64_t bx = view.x + px;
+            int64_t x0 = (bx << shift) / size;
+            int64_t x1 = PICASSO_MIN(PICASSO_MAX(((bx + 1) << shift) / size, x0 + 1),
+                                     (int64_t)b->width);
+
+            uint64_t revealed = 0, flagged = 0;
+            uint64_t cells    = (uint64_t)(x1 - x0) * (uint64_t)(y1 - y0);
+
+            if (shift >= BOARD_CHUNK_SHIFT) {
+                if (chunks && bx < cols && by < rows) {
+                    board_summary chunk = chunks[by * cols + bx];
+                    revealed = chunk.revealed;
+                    flagged  = chunk.flagged;
+                }
+            } else {
+                for (int64_t y = y0; y < y1; y++) {
+                    for (int64_t x = x0; x < x1; x++) {
+                        cell c = BOARD_CELL(b, x, y);
+                        revealed += (c & CELL_REVEALED) != 0;
+                        flagged  += (c & CELL_FLAGGED) != 0;
+                    }
+                }
+            }
+
+            row[px] = shade_cells(revealed, flagged, cells);
+        }
+    }
+
+    picasso_add_damage(canvas, (picasso_rect){ 0, 0, width, height });
+    return true;
+}
+
+/* Redraws what changed on the canvas, tiles down to MIN_CELL_SIZE and the
+ * shaded overview below. After a pan or zoom everything is redrawn. Only
+ * cells in the view are visited, so the cost follows the canvas size and
+ * not the board size. Returns whether anything was drawn */
+bool draw_canvas(picasso_backbuffer *renderer, picasso_backbuffer *background,
+        board *b, picasso_texture *texture, game_state state)
+{
+    int size   = view.cell_size;
+    bool tiles = size >= MIN_CELL_SIZE;
+
+    // The cells stay dirty when the cache can't be built, to try again
+    if (tiles && !cache_sprites(&tile_cache, texture, TILE_SPRITES, TILE_COUNT,
+                                TILE_SIZE, TILE_SIZE, size, size))
+        return false;
+
+    /* After a pan or zoom every tile moved, and the canvas past the edge
+     * of a small board shows the background again */
+    static viewport drawn_view = {0};
+    if (drawn_view.cell_size != view.cell_size || drawn_view.shift != view.shift ||
+        drawn_view.x != view.x || drawn_view.y != view.y)
+    {
+        drawn_view = view;
+        board_mark_all_dirty(b);
+
+        int board_w = (int)PICASSO_MIN(view_pixels(b->width),  (int64_t)CANVAS_WIDTH);
+        int board_h = (int)PICASSO_MIN(view_pixels(b->height), (int64_t)CANVAS_HEIGHT);
+        picasso_draw_layer_rect(renderer, background, (picasso_rect){
+            CANVAS_X + board_w, CANVAS_Y, CANVAS_WIDTH - board_w, CANVAS_HEIGHT });
+        picasso_draw_layer_rect(renderer, background, (picasso_rect){
+            CANVAS_X, CANVAS_Y + board_h, board_w, CANVAS_HEIGHT - board_h });
+    }
+
+    /* Drawing goes into the canvas part of the renderer, which clips the
+     * cells cut by its edges. Its damage moves over to the renderer */
+    picasso_backbuffer canvas = {
+        .pixels = renderer->pixels + (size_t)CANVAS_Y * renderer->pitch + CANVAS_X,
+        .width  = CANVAS_WIDTH,
+        .height = CANVAS_HEIGHT,
+        .pitch  = renderer->pitch,
+    };
+
+    bool drawn = tiles ? draw_tiles(&canvas, b, state) : draw_overview(&canvas, b);
+
+    const picasso_rect *damage;
+    int damage_count = picasso_get_damage(&canvas, &damage);
+    for (int i = 0; i < damage_count; i++)
+        picasso_add_damage(renderer, (picasso_rect){
+            damage[i].x + CANVAS_X, damage[i].y + CANVAS_Y,
+            damage[i].width, damage[i].height });
+
+    board_clear_dirty(b);
+    return drawn;
+}
+
+bool draw_numbers(picasso_backbuffer *renderer, picasso_texture *texture,
         int *number_of_bombs, int last_second)
 {
 #define OFFSET 16
 
-    int bombs			= *number_of_bombs;
+    // Three digits each, like the classic counters
+    int bombs			= PICASSO_CLAMP(*number_of_bombs, -99, 999);
+    last_second			= PICASSO_CLAMP(last_second, 0, 999);
+
+    // The counters are only redrawn when one of them changes
+    static int drawn_bombs  = INT_MIN;
+    static int drawn_second = INT_MIN;
+    if (bombs == drawn_bombs && last_second == drawn_second) return false;
+
+    if (!cache_sprites(&digit_cache, texture, DIGIT_SPRITES, DIGIT_COUNT,
+                       13, 23, 20, 34))
+        return false;
+    drawn_bombs  = bombs;
+    drawn_second = last_second;
 
     int	hundreds		= (bombs / 100)				 + OFFSET;
     int tens			= ((abs(bombs) % 100) / 10)  + OFFSET;
@@ -395,47 +761,32 @@ void draw_numbers(picasso_backbuffer *renderer, picasso_image *texture,
     if(bombs < 100 && bombs > -10 )		hundreds = 27; // BLANK
     if(bombs < 10 && bombs >= 0)		tens = 27;
 
-    picasso_rect numbers					= { .width = 13, .height = 23, };
-    picasso_rect numbers_destination		= { 28, 28, 20, 34 };
-
-    // Left numbers
-    numbers.x = sprites[hundreds].x;
-    numbers.y = sprites[hundreds].y;
-    numbers_destination.x += 0;
-    picasso_blit_rect(renderer, texture, numbers, numbers_destination);
-
-    numbers.x = sprites[tens].x;
-    numbers.y = sprites[tens].y;
-    numbers_destination.x += 19;
-    picasso_blit_rect(renderer, texture, numbers, numbers_destination);
-
-    numbers.x = sprites[ones].x;
-    numbers.y = sprites[ones].y;
-    numbers_destination.x += 19;
-    picasso_blit_rect(renderer, texture, numbers, numbers_destination);
-
-    // Right numbers
-    numbers.x = sprites[s_ones].x;
-    numbers.y = sprites[s_ones].y;
-    numbers_destination.x  = 375;
-    picasso_blit_rect(renderer, texture, numbers, numbers_destination);
-
-    numbers.x = sprites[s_tens].x;
-    numbers.y = sprites[s_tens].y;
-    numbers_destination.x -= 19;
-    picasso_blit_rect(renderer, texture, numbers, numbers_destination);
-
-    numbers.x = sprites[s_hundreds].x;
-    numbers.y = sprites[s_hundreds].y;
-    numbers_destination.x -= 19;
-    picasso_blit_rect(renderer, texture, numbers, numbers_destination);
+    // Bombs left counted from the left, seconds from the right
+    int digits[6]      = { hundreds, tens, ones, s_ones, s_tens, s_hundreds };
+    int digit_x[6]     = { 28, 47, 66, 375, 356, 337 };
+    picasso_sprite counters[6];
+
+    for (int i = 0; i < 6; i++)
+        counters[i] = (picasso_sprite){ (digits[i] - DIGIT_SPRITES) * 20, 0,
+                                        digit_x[i], 28 };
+
+    picasso_blit_batch(renderer, &(picasso_sprite_batch){
+        .atlas      = digit_cache.texture,
+        .src_width  = 20, .src_height = 34,
+        .dst_width  = 20, .dst_height = 34,
+        .sprites    = counters,
+        .count      = 6,
+    });
 
 #undef OFFSET
+    return true;
 }
 
-void draw_face(picasso_backbuffer *renderer, picasso_image *texture, rect *face,
+bool draw_face(picasso_backbuffer *renderer, picasso_texture *texture, rect *face,
         game_state *state)
 {
+    static int drawn_tile = -1;
+
     face->src.width	    = 24;
     face->src.height    = 24;
     face->dst.x	        = 194;
@@ -446,18 +797,31 @@ void draw_face(picasso_backbuffer *renderer, picasso_image *texture, rect *face,
     if (*state == WON)  		face->tile = FACE_GLASSES;
     if (*state == GAME_OVER)	face->tile = FACE_DEAD;
 
+    if ((int)face->tile == drawn_tile) return false;
+
+    if (!cache_sprites(&face_cache, texture, FACE_SPRITES, FACE_COUNT,
+                       face->src.width, face->src.height,
+                       face->dst.width, face->dst.height))
+        return false;
+    drawn_tile = face->tile;
+
     face->src.x = sprites[face->tile].x;
     face->src.y = sprites[face->tile].y;
 
-    picasso_blit_rect(renderer,texture, face->src, face->dst);
+    picasso_blit_batch(renderer, &(picasso_sprite_batch){
+        .atlas      = face_cache.texture,
+        .src_width  = face->dst.width, .src_height = face->dst.height,
+        .dst_width  = face->dst.width, .dst_height = face->dst.height,
+        .sprites    = &(picasso_sprite){ (face->tile - FACE_SPRITES) * face->dst.width, 0,
+                                         face->dst.x, face->dst.y },
+        .count      = 1,
+    });
+    return true;
 }
 
-void process_input(canopy_window *window, cell grid[COL][ROW], rect *face,
-        game_state *state, int *bomb_count)
+void process_input(canopy_window *window, board *b, rect *face,
+        game_state *state)
 {
-#define MINE      (grid[grid_y][grid_x])
-#define MINE_LAST (grid[pressed_y][pressed_x])
-
     canopy_event event;
     int mouse_x, mouse_y, grid_x, grid_y;
     bool in_canvas, on_face;
@@ -465,6 +829,24 @@ void process_input(canopy_window *window, cell grid[COL][ROW], rect *face,
     static int pressed_x = -1;
     static int pressed_y = -1;
 
+    /* A middle click, or left and right held together, chords. The first
+     * button released fires the chord and the others are swallowed */
+    static unsigned held_buttons = 0;
+    static bool chording = false;
+    static bool chord_fired = false;
+    const unsigned both = (1u << CANOPY_MOUSE_BUTTON_LEFT) |
+                          (1u << CANOPY_MOUSE_BUTTON_RIGHT);
+
+    /* A left drag on a board larger than the canvas pans it, once it moved
+     * past the slop. The press is dropped then, and the release ignored */
+    static int drag_x, drag_y;
+    static int64_t drag_view_x, drag_view_y;
+    static bool dragging = false;
+    static bool panning = false;
+
+    // Scroll deltas may come in fractions of a step
+    static float zoom_scroll = 0.0f;
+
     while (canopy_poll_event(&event)) {
         switch (event.type) {
 
@@ -474,6 +856,21 @@ void process_input(canopy_window *window, cell grid[COL][ROW], rect *face,
                     INFO("Escape pressed");
                     canopy_set_window_should_close(window);
                 }
+                if (event.key.action == CANOPY_KEY_PRESS &&
+                        event.key.keycode == CANOPY_KEY_P) {
+                    canopy_profile_dump(stdout);
+                }
+                // Arrows pan a cell at a time, at least a tile's worth zoomed out
+                if (event.key.action == CANOPY_KEY_PRESS) {
+                    int step = PICASSO_MAX(view.cell_size, MIN_CELL_SIZE);
+                    switch (event.key.keycode) {
+                        case CANOPY_KEY_LEFT:  move_view(b, view.x - step, view.y); break;
+                        case CANOPY_KEY_RIGHT: move_view(b, view.x + step, view.y); break;
+                        case CANOPY_KEY_UP:    move_view(b, view.x, view.y - step); break;
+                        case CANOPY_KEY_DOWN:  move_view(b, view.x, view.y + step); break;
+                        default: break;
+                    }
+                }
                 break;
 
             case CANOPY_EVENT_MOUSE:
@@ -483,34 +880,52 @@ void process_input(canopy_window *window, cell grid[COL][ROW], rect *face,
                         mouse_x = event.mouse.x;
                         mouse_y = event.mouse.y;
 
-                        grid_x = (mouse_x - CANVAS_X) / CELL_SIZE;
-                        grid_y = (mouse_y - CANVAS_Y) / CELL_SIZE;
+                        in_canvas = cell_at(b, mouse_x, mouse_y, &grid_x, &grid_y);
 
-                        pressed_x = grid_x;
-                        pressed_y = grid_y;
+                        if (event.mouse.button == CANOPY_MOUSE_BUTTON_LEFT) {
+                            dragging    = on_canvas(mouse_x, mouse_y) && view_scrolls(b);
+                            drag_x      = mouse_x;
+                            drag_y      = mouse_y;
+                            drag_view_x = view.x;
+                            drag_view_y = view.y;
+                        }
 
-                        in_canvas = (mouse_x >= CANVAS_X && grid_x < GRIDSIZE &&
-                                mouse_y >= CANVAS_Y && grid_y < GRIDSIZE);
+                        // Only remember presses that land on the board
+                        pressed_x = in_canvas ? grid_x : -1;
+                        pressed_y = in_canvas ? grid_y : -1;
 
                         on_face = (mouse_x >= 196 && mouse_x <= 236 &&
                                 mouse_y >= 26 && mouse_y <= 62);
 
+                        if (event.mouse.button < CANOPY_MAX_MOUSE_BUTTONS)
+                            held_buttons |= 1u << event.mouse.button;
+                        if (event.mouse.button == CANOPY_MOUSE_BUTTON_MIDDLE ||
+                            (held_buttons & both) == both)
+                            chording = true;
+
                         switch (event.mouse.button) {
                             case CANOPY_MOUSE_BUTTON_LEFT:
                                 if (on_face) {
                                     face->tile = FACE_PRESSED;
                                     *state = RESTARTING;
                                 } else if (in_canvas && *state == PLAYING &&
-                                           !MINE.is_flagged)
+                                           !(board_get_cell(b, grid_x, grid_y) & CELL_FLAGGED))
                                 {
-                                    MINE.is_pressed = true;
+                                    hold_tile(b, grid_x, grid_y);
                                     face->tile = FACE_SHOCK;
                                 }
                                 break;
 
                             case CANOPY_MOUSE_BUTTON_RIGHT:
                                 if (in_canvas && *state == PLAYING) {
-                                    MINE.is_pressed = true;
+                                    hold_tile(b, grid_x, grid_y);
+                                }
+                                break;
+
+                            case CANOPY_MOUSE_BUTTON_MIDDLE:
+                                if (in_canvas && *state == PLAYING) {
+                                    hold_tile(b, grid_x, grid_y);
+                                    face->tile = FACE_SHOCK;
                                 }
                                 break;
 
@@ -518,58 +933,110 @@ void process_input(canopy_window *window, cell grid[COL][ROW], rect *face,
                         }
                         break;
 
+                    case CANOPY_MOUSE_DRAG:
+                        if (!dragging || event.mouse.button != CANOPY_MOUSE_BUTTON_LEFT ||
+                            held_buttons != 1u << CANOPY_MOUSE_BUTTON_LEFT)
+                            break;
+
+                        mouse_x = event.mouse.x;
+                        mouse_y = event.mouse.y;
+
+                        if (!panning && abs(mouse_x - drag_x) + abs(mouse_y - drag_y) > DRAG_SLOP) {
+                            panning   = true;
+                            pressed_x = -1;
+                            pressed_y = -1;
+                            hold_tile(b, -1, -1);
+                            face->tile = FACE_NORMAL;
+                        }
+                        if (panning)
+                            move_view(b, drag_view_x - (mouse_x - drag_x),
+                                      drag_view_y - (mouse_y - drag_y));
+                        break;
+
+                    case CANOPY_MOUSE_SCROLL: {
+                        zoom_scroll += event.mouse.scroll_y;
+                        int steps    = (int)zoom_scroll;
+                        zoom_scroll -= (float)steps;
+                        if (steps == 0) break;
+
+                        // Zoom at the mouse, or the canvas middle when it is elsewhere
+                        int cx = event.mouse.x - CANVAS_X;
+                        int cy = event.mouse.y - CANVAS_Y;
+                        if (!on_canvas(event.mouse.x, event.mouse.y)) {
+                            cx = CANVAS_WIDTH / 2;
+                            cy = CANVAS_HEIGHT / 2;
+                        }
+                        // The pressed tile would stay pressed at its old place
+                        hold_tile(b, -1, -1);
+                        zoom_view(b, steps, cx, cy);
+                        break;
+                    }
+
                     case CANOPY_MOUSE_RELEASE:
                         mouse_x = event.mouse.x;
                         mouse_y = event.mouse.y;
 
-                        grid_x = (mouse_x - CANVAS_X) / CELL_SIZE;
-                        grid_y = (mouse_y - CANVAS_Y) / CELL_SIZE;
+                        in_canvas = cell_at(b, mouse_x, mouse_y, &grid_x, &grid_y);
 
-                        in_canvas = (mouse_x >= CANVAS_X && grid_x < GRIDSIZE &&
-                                mouse_y >= CANVAS_Y && grid_y < GRIDSIZE);
+                        if (event.mouse.button < CANOPY_MAX_MOUSE_BUTTONS)
+                            held_buttons &= ~(1u << event.mouse.button);
 
                         // Always unpress the previously pressed tile
-                        MINE_LAST.is_pressed = false;
+                        hold_tile(b, -1, -1);
                         face->tile = FACE_NORMAL;
 
+                        if (event.mouse.button == CANOPY_MOUSE_BUTTON_LEFT) {
+                            dragging = false;
+                            if (panning) {
+                                panning = false;
+                                break;
+                            }
+                        }
+
+                        if (chording) {
+                            if (!chord_fired && in_canvas &&
+                                pressed_x == grid_x && pressed_y == grid_y &&
+                                *state == PLAYING)
+                            {
+                                CANOPY_PROFILE_BEGIN(chord);
+                                board_chord(b, grid_x, grid_y);
+                                CANOPY_PROFILE_END(chord);
+                            }
+                            chord_fired = true;
+
+                            if (!held_buttons) {
+                                chording    = false;
+                                chord_fired = false;
+                            }
+                            pressed_x = -1;
+                            pressed_y = -1;
+                            break;
+                        }
+
                         // Only process if release matches press and is in bounds
                         if (pressed_x != grid_x || pressed_y != grid_y ||
                             !in_canvas) break;
 
                         switch (event.mouse.button) {
                             case CANOPY_MOUSE_BUTTON_LEFT:
-                                if (*state == PLAYING && *state != WON) {
-                                    if (!MINE_LAST.is_flagged) {
-                                        if (MINE_LAST.is_bomb) {
-                                            MINE_LAST.is_revealed = true;
-                                            *state = GAME_OVER;
-                                        }
-
-                                        reveal_tiles(grid, grid_x, grid_y);
-
-                                        if (MINE_LAST.is_question)
-                                            MINE_LAST.is_question = false;
-                                    }
+                                if (*state != PLAYING) break;
+
+                                // Generated here so it shows apart in traces
+                                if (!b->generated &&
+                                    !(board_get_cell(b, grid_x, grid_y) & CELL_FLAGGED)) {
+                                    CANOPY_PROFILE_BEGIN(generate);
+                                    board_generate(b, grid_x, grid_y);
+                                    CANOPY_PROFILE_END(generate);
                                 }
+
+                                CANOPY_PROFILE_BEGIN(reveal);
+                                board_reveal(b, grid_x, grid_y);
+                                CANOPY_PROFILE_END(reveal);
                                 break;
 
                             case CANOPY_MOUSE_BUTTON_RIGHT:
-                                if (!MINE_LAST.is_revealed && *state == PLAYING){
-                                    if (!MINE_LAST.is_flagged &&
-                                        !MINE_LAST.is_question)
-                                    {
-                                        MINE_LAST.is_flagged = true;
-                                        (*bomb_count)--;
-                                    }
-                                    else if (MINE_LAST.is_flagged) {
-                                        MINE_LAST.is_flagged = false;
-                                        MINE_LAST.is_question = true;
-                                        (*bomb_count)++;
-                                    }
-                                    else {
-                                        MINE_LAST.is_question = false;
-                                    }
-                                }
+                                if (*state == PLAYING)
+                                    board_flag(b, grid_x, grid_y);
                                 break;
 
                             default: break;
@@ -586,7 +1053,4 @@ void process_input(canopy_window *window, cell grid[COL][ROW], rect *face,
             default: break;
         } // end switch (event.type)
     } // end while (canopy_poll_event)
-
-#undef MINE
-#undef MINE_LAST
 }
@@ -4,6 +4,12 @@
 #include <string.h>
 #include <blackbox.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "picasso.h"
 
 void picasso_image_free(picasso_image *img);
@@ -312,26 +318,293 @@ static bool picasso__clip_rect_to_bounds(picasso_backbuffer *bf, const picasso_r
     return true;
 }
 
+/* Records drawn bounds. Regions inside an earlier one are dropped and
+ * earlier ones inside the new one are replaced */
+static void picasso__damage(picasso_backbuffer *bf, picasso_draw_bounds b)
+{
+    if (b.x0 >= b.x1 || b.y0 >= b.y1) return;
+
+    picasso_rect r = { b.x0, b.y0, b.x1 - b.x0, b.y1 - b.y0 };
+
+    for (int i = 0; i < bf->damage_count; ++i) {
+        picasso_rect *d = &bf->damage[i];
+        bool inside = r.x >= d->x && r.y >= d->y &&
+                      r.x + r.width <= d->x + d->width &&
+                      r.y + r.height <= d->y + d->height;
+        if (inside) return;
+
+        bool covers = d->x >= r.x && d->y >= r.y &&
+                      d->x + d->width <= r.x + r.width &&
+                      d->y + d->height <= r.y + r.height;
+        if (covers) bf->damage[i--] = bf->damage[--bf->damage_count];
+    }
+
+    if (bf->damage_count == PICASSO_MAX_DAMAGE) {
+        for (int i = 0; i < bf->damage_count; ++i) {
+            picasso_rect d = bf->damage[i];
+            b.x0 = PICASSO_MIN(b.x0, d.x);
+            b.y0 = PICASSO_MIN(b.y0, d.y);
+            b.x1 = PICASSO_MAX(b.x1, d.x + d.width);
+            b.y1 = PICASSO_MAX(b.y1, d.y + d.height);
+        }
+        r = (picasso_rect){ b.x0, b.y0, b.x1 - b.x0, b.y1 - b.y0 };
+        bf->damage_count = 0;
+    }
+
+    bf->damage[bf->damage_count++] = r;
+}
+
+/* Nearest neighbor scaling maps destination offset rel to source
+ * start + rel * src_len / dst_len. Stepping the quotient and remainder
+ * gives the same coordinates without a divide per pixel */
+typedef struct {
+    int q, r;           // current source coordinate and remainder
+    int step_q, step_r;
+    int den;
+} picasso__stepper;
+
+static inline picasso__stepper picasso__stepper_init(int start, int src_len,
+                                                      int dst_len, int rel)
+{
+    int64_t n = (int64_t)rel * src_len;
+    return (picasso__stepper){
+        .q      = start + (int)(n / dst_len),
+        .r      = (int)(n % dst_len),
+        .step_q = src_len / dst_len,
+        .step_r = src_len % dst_len,
+        .den    = dst_len,
+    };
+}
+
+static inline int picasso__stepper_next(picasso__stepper *s)
+{
+    int v = s->q;
+    s->q += s->step_q;
+    s->r += s->step_r;
+    if (s->r >= s->den) {
+        s->r -= s->den;
+        s->q++;
+    }
+    return v;
+}
+
+/* Source column of every destination column in the clipped span, once
+ * per blit. Small spans live on the caller's stack */
+#define PICASSO_MAP_STACK 1024
+
+static int *picasso__column_map(int *stack, const picasso_rect *src_rect,
+                                const picasso_rect *dst_rect,
+                                const picasso_draw_bounds *bounds)
+{
+    int cols = bounds->x1 - bounds->x0;
+    int *map = cols <= PICASSO_MAP_STACK ? stack
+             : picasso_malloc((size_t)cols * sizeof(int));
+    if (!map) return NULL;
+
+    picasso__stepper xs = picasso__stepper_init(src_rect->x, src_rect->width,
+                                                dst_rect->width,
+                                                bounds->x0 - dst_rect->x);
+    for (int i = 0; i < cols; ++i) map[i] = picasso__stepper_next(&xs);
+
+    return map;
+}
+
+// --------------------------------------------------------
+// Blending
+// --------------------------------------------------------
+
+/* floor(x / 255) and round(x / 255) for x up to 255 * 255 without a
+ * divide, checked exhaustively over that range. The same shifts run in
+ * 16-bit SIMD lanes below */
+#define PICASSO_DIV255(x)       (((x) + 1 + ((x) >> 8)) >> 8)
+#define PICASSO_DIV255_ROUND(x) ((((x) + 128) + (((x) + 128) >> 8)) >> 8)
+
 static inline uint32_t picasso__blend_pixel(uint32_t dst, uint32_t src)
 {
-    uint8_t sa = (src >> 24) & 0xFF;
+    uint32_t sa = src >> 24;
     if (sa == 255) return src;
     if (sa == 0) return dst;
 
-    uint8_t sr = src & 0xFF;
-    uint8_t sg = (src >> 8) & 0xFF;
-    uint8_t sb = (src >> 16) & 0xFF;
+    uint32_t inv = 255 - sa;
+    uint32_t r = PICASSO_DIV255((src & 0xFF)         * sa + (dst & 0xFF)         * inv);
+    uint32_t g = PICASSO_DIV255(((src >> 8) & 0xFF)  * sa + ((dst >> 8) & 0xFF)  * inv);
+    uint32_t b = PICASSO_DIV255(((src >> 16) & 0xFF) * sa + ((dst >> 16) & 0xFF) * inv);
 
-    uint8_t dr = dst & 0xFF;
-    uint8_t dg = (dst >> 8) & 0xFF;
-    uint8_t db = (dst >> 16) & 0xFF;
+    return (0xFFu << 24) | (b << 16) | (g << 8) | r;
+}
+
+/* picasso__blend_pixel for sources with premultiplied alpha. The source
+ * was rounded when it was premultiplied, so a channel can land 1 away
+ * from the straight alpha result, this is not bit-identical to it */
+static inline uint32_t picasso__blend_premultiplied(uint32_t dst, uint32_t src)
+{
+    uint32_t sa = src >> 24;
+    if (sa == 255) return src;
+    if (sa == 0) return dst;
+
+    uint32_t inv = 255 - sa;
+    uint32_t r = (src & 0xFF)         + PICASSO_DIV255_ROUND((dst & 0xFF)         * inv);
+    uint32_t g = ((src >> 8) & 0xFF)  + PICASSO_DIV255_ROUND(((dst >> 8) & 0xFF)  * inv);
+    uint32_t b = ((src >> 16) & 0xFF) + PICASSO_DIV255_ROUND(((dst >> 16) & 0xFF) * inv);
+
+    return (0xFFu << 24) | (b << 16) | (g << 8) | r;
+}
+
+/* The kernels widen pixels to 16-bit lanes, r g b a per pixel, blend them
+ * with the exact divides above and narrow them back. A pixel with alpha 0
+ * keeps the destination untouched, like the scalar blend. Every group is
+ * checked first, fully opaque groups are stored and fully transparent
+ * groups skipped */
+#if defined(__SSE2__)
+static inline __m128i picasso__div255_sse2(__m128i x)
+{
+    __m128i t = _mm_add_epi16(x, _mm_srli_epi16(x, 8));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_set1_epi16(1)), 8);
+}
+
+static inline __m128i picasso__blend_half_sse2(__m128i d, __m128i s, bool premultiplied)
+{
+    __m128i a   = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+    __m128i inv = _mm_sub_epi16(_mm_set1_epi16(255), a);
+
+    if (premultiplied) {
+        __m128i x = _mm_add_epi16(_mm_mullo_epi16(d, inv), _mm_set1_epi16(128));
+        return _mm_add_epi16(s, _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8));
+    }
+    return picasso__div255_sse2(_mm_add_epi16(_mm_mullo_epi16(s, a),
+                                              _mm_mullo_epi16(d, inv)));
+}
 
-    uint8_t r = (sr * sa + dr * (255 - sa)) / 255;
-    uint8_t g = (sg * sa + dg * (255 - sa)) / 255;
-    uint8_t b = (sb * sa + db * (255 - sa)) / 255;
+static inline __m128i picasso__blend4_sse2(__m128i d, __m128i s, bool premultiplied)
+{
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+
+    __m128i lo = picasso__blend_half_sse2(_mm_unpacklo_epi8(d, zero),
+                                          _mm_unpacklo_epi8(s, zero), premultiplied);
+    __m128i hi = picasso__blend_half_sse2(_mm_unpackhi_epi8(d, zero),
+                                          _mm_unpackhi_epi8(s, zero), premultiplied);
+    __m128i out = _mm_or_si128(_mm_packus_epi16(lo, hi), alpha);
+
+    __m128i clear = _mm_cmpeq_epi32(_mm_and_si128(s, alpha), zero);
+    return _mm_or_si128(_mm_and_si128(clear, d), _mm_andnot_si128(clear, out));
+}
+#endif
+
+#if defined(__AVX2__)
+static inline __m256i picasso__blend_half_avx2(__m256i d, __m256i s, bool premultiplied)
+{
+    __m256i a   = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xFF), 0xFF);
+    __m256i inv = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+
+    if (premultiplied) {
+        __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(d, inv), _mm256_set1_epi16(128));
+        return _mm256_add_epi16(s, _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8));
+    }
+    __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(s, a), _mm256_mullo_epi16(d, inv));
+    __m256i t = _mm256_add_epi16(x, _mm256_srli_epi16(x, 8));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_set1_epi16(1)), 8);
+}
 
-    return (0xFF << 24) | (b << 16) | (g << 8) | r;
+static inline __m256i picasso__blend8_avx2(__m256i d, __m256i s, bool premultiplied)
+{
+    const __m256i zero  = _mm256_setzero_si256();
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+
+    // Unpack and pack both work within 128-bit lanes, so pixel order holds
+    __m256i lo = picasso__blend_half_avx2(_mm256_unpacklo_epi8(d, zero),
+                                          _mm256_unpacklo_epi8(s, zero), premultiplied);
+    __m256i hi = picasso__blend_half_avx2(_mm256_unpackhi_epi8(d, zero),
+                                          _mm256_unpackhi_epi8(s, zero), premultiplied);
+    __m256i out = _mm256_or_si256(_mm256_packus_epi16(lo, hi), alpha);
+
+    __m256i clear = _mm256_cmpeq_epi32(_mm256_and_si256(s, alpha), zero);
+    return _mm256_blendv_epi8(out, d, clear);
 }
+#endif
+
+static inline void picasso__blend_span(uint32_t *dst, const uint32_t *src,
+                                       int count, bool premultiplied)
+{
+    int x = 0;
+
+#if defined(__AVX2__)
+    const __m256i alpha256 = _mm256_set1_epi32((int)0xFF000000);
+    for (; x + 8 <= count; x += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + x));
+        __m256i a = _mm256_and_si256(s, alpha256);
+
+        if (_mm256_testc_si256(a, alpha256)) {          // all opaque
+            _mm256_storeu_si256((__m256i *)(dst + x), s);
+        } else if (!_mm256_testz_si256(a, alpha256)) {  // not all clear
+            __m256i d = _mm256_loadu_si256((const __m256i *)(dst + x));
+            _mm256_storeu_si256((__m256i *)(dst + x),
+                                picasso__blend8_avx2(d, s, premultiplied));
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i alpha128 = _mm_set1_epi32((int)0xFF000000);
+    const __m128i zero128  = _mm_setzero_si128();
+    for (; x + 4 <= count; x += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + x));
+        __m128i a = _mm_and_si128(s, alpha128);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, alpha128)) == 0xFFFF) {
+            _mm_storeu_si128((__m128i *)(dst + x), s);
+        } else if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, zero128)) != 0xFFFF) {
+            __m128i d = _mm_loadu_si128((const __m128i *)(dst + x));
+            _mm_storeu_si128((__m128i *)(dst + x),
+                             picasso__blend4_sse2(d, s, premultiplied));
+        }
+    }
+#endif
+
+    for (; x < count; ++x) {
+        dst[x] = premultiplied ? picasso__blend_premultiplied(dst[x], src[x])
+                               : picasso__blend_pixel(dst[x], src[x]);
+    }
+}
+
+void picasso_blend_span(uint32_t *dst, const uint32_t *src, int count)
+{
+    picasso__blend_span(dst, src, count, false);
+}
+
+void picasso_blend_span_premultiplied(uint32_t *dst, const uint32_t *src, int count)
+{
+    picasso__blend_span(dst, src, count, true);
+}
+
+void picasso_blend_span_color(uint32_t *dst, uint32_t src, int count)
+{
+    uint32_t sa = src >> 24;
+    if (sa == 0 || count <= 0) return;
+
+    int x = 0;
+    if (sa == 255) {
+        for (; x < count; ++x) dst[x] = src;
+        return;
+    }
+
+#if defined(__AVX2__)
+    const __m256i s256 = _mm256_set1_epi32((int)src);
+    for (; x + 8 <= count; x += 8) {
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + x));
+        _mm256_storeu_si256((__m256i *)(dst + x), picasso__blend8_avx2(d, s256, false));
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i s128 = _mm_set1_epi32((int)src);
+    for (; x + 4 <= count; x += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + x));
+        _mm_storeu_si128((__m128i *)(dst + x), picasso__blend4_sse2(d, s128, false));
+    }
+#endif
+
+    for (; x < count; ++x) dst[x] = picasso__blend_pixel(dst[x], src);
+}
+
 // --------------------------------------------------------
 // Backbuffer operations
 // --------------------------------------------------------
@@ -356,6 +629,10 @@ picasso_backbuffer* picasso_create_backbuffer(int width, int height)
         return NULL;
     }
 
+    // Nothing of a new buffer has been presented yet
+    bf->damage_count = 0;
+    picasso__damage(bf, (picasso_draw_bounds){ 0, 0, width, height });
+
     return bf;
 }
 
@@ -395,23 +672,42 @@ picasso_image *picasso_image_from_backbuffer(const picasso_backbuffer *bf)
     return img;
 }
 
+/* Source columns [first, last) of a column map that fall inside the
+ * source, the map only grows so they are one run */
+static void picasso__map_range(const int *map, int cols, int limit,
+                               int *first, int *last)
+{
+    int i0 = 0, i1 = cols;
+    while (i0 < i1 && map[i0] < 0) ++i0;
+    while (i1 > i0 && map[i1 - 1] >= limit) --i1;
+    *first = i0;
+    *last  = i1;
+}
+
 void picasso_blit_bitmap(picasso_backbuffer *dst, picasso_image *src, int offset_x, int offset_y)
 {
     if (!dst || !src || !src->pixels || !dst->pixels) return;
 
-    foreach_pixel_image(src, {
-        int dst_x = x + offset_x;
-        int dst_y = y + offset_y;
-        if (dst_x < 0 || dst_x >= (int)dst->width ||
-            dst_y < 0 || dst_y >= (int)dst->height)
-            continue;
+    picasso_rect r = { offset_x, offset_y, src->width, src->height };
+    picasso_draw_bounds bounds;
+    if (!picasso__clip_rect_to_bounds(dst, &r, &bounds)) return;
+    picasso__damage(dst, bounds);
 
-        color c = get_color(pixels, src->channels);
-        uint32_t rgba = color_to_u32(c);
+    // Rows are converted to the backbuffer layout in chunks, then blended
+    uint32_t row[PICASSO_MAP_STACK];
+
+    for (int y = bounds.y0; y < bounds.y1; ++y) {
+        const uint8_t *src_row = &src->pixels[(y - offset_y) * src->row_stride];
 
-        uint32_t *dst_pixel = &dst->pixels[dst_y * dst->width + dst_x];
-        *dst_pixel = picasso__blend_pixel(*dst_pixel, rgba);
-    });
+        for (int x0 = bounds.x0; x0 < bounds.x1; x0 += PICASSO_MAP_STACK) {
+            int n = PICASSO_MIN(bounds.x1 - x0, PICASSO_MAP_STACK);
+            for (int i = 0; i < n; ++i) {
+                const uint8_t *pixel = &src_row[(x0 + i - offset_x) * src->channels];
+                row[i] = color_to_u32(get_color(pixel, src->channels));
+            }
+            picasso_blend_span(&dst->pixels[y * dst->pitch + x0], row, n);
+        }
+    }
 }
 
 void picasso_blit_rect(picasso_backbuffer *dst, picasso_image *src,
@@ -426,28 +722,393 @@ void picasso_blit_rect(picasso_backbuffer *dst, picasso_image *src,
     picasso_draw_bounds bounds;
     if (!picasso__clip_rect_to_bounds(dst, &dst_rect, &bounds))
         return;
+    picasso__damage(dst, bounds);
+
+    int stack_map[PICASSO_MAP_STACK];
+    int *map = picasso__column_map(stack_map, &src_rect, &dst_rect, &bounds);
+    if (!map) return;
+
+    picasso__stepper ys = picasso__stepper_init(src_rect.y, src_rect.height,
+                                                dst_rect.height,
+                                                bounds.y0 - dst_rect.y);
+
+    int first, last;
+    picasso__map_range(map, bounds.x1 - bounds.x0, src->width, &first, &last);
+    uint32_t row[PICASSO_MAP_STACK];
+
+    for (int dy = bounds.y0; dy < bounds.y1; ++dy) {
+        int sy = picasso__stepper_next(&ys);
+        if (sy < 0 || sy >= src->height) continue;
+
+        const uint8_t *src_row = &src->pixels[sy * src->row_stride];
+        uint32_t *dst_row      = &dst->pixels[dy * dst->pitch + bounds.x0];
+
+        for (int i0 = first; i0 < last; i0 += PICASSO_MAP_STACK) {
+            int n = PICASSO_MIN(last - i0, PICASSO_MAP_STACK);
+            for (int i = 0; i < n; ++i) {
+                color c = get_color(&src_row[map[i0 + i] * src->channels], src->channels);
+                if (src->channels == 3) PICASSO_SWAP(c.r, c.b); // RGB → BGR
+                row[i] = color_to_u32(c);
+            }
+            picasso_blend_span(dst_row + i0, row, n);
+        }
+    }
+
+    if (map != stack_map) picasso_free(map);
+}
+// --------------------------------------------------------
+// Textures
+// --------------------------------------------------------
+
+/* All the per-pixel format work of picasso_blit_rect happens here once:
+ * channel order, packing and premultiplying by alpha */
+picasso_texture *picasso_texture_from_image(const picasso_image *img)
+{
+    if (!img || !img->pixels) return NULL;
+
+    picasso_texture *tex = picasso_malloc(sizeof(picasso_texture));
+    if (!tex) return NULL;
+
+    tex->width  = img->width;
+    tex->height = img->height;
+    tex->pitch  = img->width;
+    tex->opaque = true;
+    tex->pixels = picasso_malloc((size_t)tex->pitch * tex->height * sizeof(uint32_t));
+    if (!tex->pixels) {
+        picasso_free(tex);
+        return NULL;
+    }
+
+    for (int y = 0; y < img->height; ++y) {
+        const uint8_t *row = &img->pixels[y * img->row_stride];
+        uint32_t *dst      = &tex->pixels[y * tex->pitch];
+
+        for (int x = 0; x < img->width; ++x) {
+            color c = get_color(&row[x * img->channels], img->channels);
+            if (img->channels == 3) PICASSO_SWAP(c.r, c.b); // RGB → BGR, as blit_rect
+
+            if (c.a != 255) {
+                tex->opaque = false;
+                c.r = (c.r * c.a + 127) / 255;
+                c.g = (c.g * c.a + 127) / 255;
+                c.b = (c.b * c.a + 127) / 255;
+            }
+            dst[x] = color_to_u32(c);
+        }
+    }
+
+    TRACE("Converted %dx%d image to texture (%s)", tex->width, tex->height,
+          tex->opaque ? "opaque" : "blended");
+    return tex;
+}
+
+picasso_texture *picasso_load_texture(const char *filename)
+{
+    picasso_image *img = picasso_load_bmp(filename);
+    if (!img) return NULL;
+
+    picasso_texture *tex = picasso_texture_from_image(img);
+    picasso_free_image(img);
+
+    if (!tex) ERROR("Out of memory converting %s to a texture", filename);
+    return tex;
+}
+
+void picasso_free_texture(picasso_texture *tex)
+{
+    if (tex) {
+        picasso_free(tex->pixels);
+        picasso_free(tex);
+    }
+}
+
+/* One opaque row of a scaled blit. Same size rows are a single copy and
+ * integer upscales repeat each source pixel ratio times */
+static void picasso__copy_row(uint32_t *dst_row, const uint32_t *src_row,
+                              const int *map, int cols, int ratio, int phase)
+{
+    if (ratio == 1) {
+        memcpy(dst_row, src_row + map[0], (size_t)cols * sizeof(uint32_t));
+    }
+    else if (ratio > 1) {
+        const uint32_t *s = src_row + map[0];
+        int run = ratio - phase; // the first pixel may be clipped
+        for (int i = 0; i < cols; run = ratio) {
+            uint32_t pixel = *s++;
+            for (int end = PICASSO_MIN(i + run, cols); i < end; ++i)
+                dst_row[i] = pixel;
+        }
+    }
+    else {
+        for (int i = 0; i < cols; ++i) dst_row[i] = src_row[map[i]];
+    }
+}
+
+/* Nearest neighbor like picasso_blit_rect, opaque textures skip blending.
+ * Opaque pixels match picasso_blit_rect exactly, blended ones can differ
+ * by 1 per channel through the premultiplied blend.
+ * Coordinates come from a column map and a row stepper, no divides per
+ * pixel, and rows that repeat a source row copy the row drawn above */
+void picasso_blit_texture(picasso_backbuffer *dst, const picasso_texture *src,
+                          picasso_rect src_rect, picasso_rect dst_rect)
+{
+    if (!dst || !src || !dst->pixels || !src->pixels) return;
+
+    picasso__normalize_rect(&src_rect);
+    picasso__normalize_rect(&dst_rect);
+
+    picasso_draw_bounds bounds;
+    if (!picasso__clip_rect_to_bounds(dst, &dst_rect, &bounds))
+        return;
+    picasso__damage(dst, bounds);
+
+    int stack_map[PICASSO_MAP_STACK];
+    int *map = picasso__column_map(stack_map, &src_rect, &dst_rect, &bounds);
+    if (!map) return;
+
+    // The map only grows, so checking its ends checks every column
+    int cols    = bounds.x1 - bounds.x0;
+    bool inside = map[0] >= 0 && map[cols - 1] < src->width;
+    bool copy   = src->opaque && inside;
+
+    int ratio = 0, phase = 0;
+    if (src_rect.width > 0 && dst_rect.width % src_rect.width == 0) {
+        ratio = dst_rect.width / src_rect.width;
+        phase = (bounds.x0 - dst_rect.x) % ratio;
+    }
+
+    picasso__stepper ys = picasso__stepper_init(src_rect.y, src_rect.height,
+                                                dst_rect.height,
+                                                bounds.y0 - dst_rect.y);
+    int last_sy = -1;
+    const uint32_t *last_row = NULL;
+
+    int first, last;
+    picasso__map_range(map, cols, src->width, &first, &last);
+    uint32_t row[PICASSO_MAP_STACK];
 
     for (int dy = bounds.y0; dy < bounds.y1; ++dy) {
-        int rel_dy = dy - dst_rect.y;
-        int sy = src_rect.y + rel_dy * src_rect.height / dst_rect.height;
+        int sy = picasso__stepper_next(&ys);
         if (sy < 0 || sy >= src->height) continue;
 
-        for (int dx = bounds.x0; dx < bounds.x1; ++dx) {
-            int rel_dx = dx - dst_rect.x;
-            int sx = src_rect.x + rel_dx * src_rect.width / dst_rect.width;
-            if (sx < 0 || sx >= src->width) continue;
+        const uint32_t *src_row = &src->pixels[sy * src->pitch];
+        uint32_t *dst_row       = &dst->pixels[dy * dst->pitch + bounds.x0];
+
+        if (copy) {
+            if (sy == last_sy)
+                memcpy(dst_row, last_row, (size_t)cols * sizeof(uint32_t));
+            else
+                picasso__copy_row(dst_row, src_row, map, cols, ratio, phase);
+
+            last_sy  = sy;
+            last_row = dst_row;
+            continue;
+        }
+
+        if (src->opaque) {
+            for (int i = first; i < last; ++i) dst_row[i] = src_row[map[i]];
+            continue;
+        }
+
+        for (int i0 = first; i0 < last; i0 += PICASSO_MAP_STACK) {
+            int n = PICASSO_MIN(last - i0, PICASSO_MAP_STACK);
+            for (int i = 0; i < n; ++i) row[i] = src_row[map[i0 + i]];
+            picasso_blend_span_premultiplied(dst_row + i0, row, n);
+        }
+    }
+
+    if (map != stack_map) picasso_free(map);
+}
+
+// --------------------------------------------------------
+// Sprite batches
+// --------------------------------------------------------
+
+/* Draws sprites [first, end) of a batch, which share a destination row and
+ * do not overlap, so their rows clip alike and each scanline is one walk
+ * from left to right. cols and rows map sprite relative destination pixels
+ * to sprite relative source pixels, shared by every sprite */
+static void picasso__blit_strip(picasso_backbuffer *dst, const picasso_sprite_batch *batch,
+                                const int *cols, const int *rows, int ratio,
+                                int first, int end)
+{
+    const picasso_texture *atlas = batch->atlas;
+    int dw = batch->dst_width, dh = batch->dst_height;
+    int sw = batch->src_width, sh = batch->src_height;
+
+    int top   = batch->sprites[first].dst_y + batch->offset_y;
+    int y0    = PICASSO_MAX(top, 0);
+    int y1    = PICASSO_MIN(top + dh, (int)dst->height);
+    if (y0 >= y1) return;
+
+    uint32_t row[PICASSO_MAP_STACK];
+
+    for (int i = first; i < end; ++i) {
+        const picasso_sprite *s = &batch->sprites[i];
+        int left = s->dst_x + batch->offset_x;
+        int x0   = PICASSO_MAX(left, 0);
+        int x1   = PICASSO_MIN(left + dw, (int)dst->width);
+        if (x0 >= x1) continue;
+
+        picasso__damage(dst, (picasso_draw_bounds){ x0, y0, x1, y1 });
+
+        // Sprites reaching out of the atlas skip columns, leave them to the plain blit
+        if (s->src_x < 0 || s->src_y < 0 ||
+            s->src_x + sw > atlas->width || s->src_y + sh > atlas->height)
+        {
+            picasso_blit_texture(dst, atlas,
+                                 (picasso_rect){ s->src_x, s->src_y, sw, sh },
+                                 (picasso_rect){ left, top, dw, dh });
+        }
+    }
+
+    for (int dy = y0; dy < y1; ++dy) {
+        int r = rows[dy - top];
+        bool repeat = dy > y0 && r == rows[dy - 1 - top];
+
+        for (int i = first; i < end; ++i) {
+            const picasso_sprite *s = &batch->sprites[i];
+            int left = s->dst_x + batch->offset_x;
+            int x0   = PICASSO_MAX(left, 0);
+            int x1   = PICASSO_MIN(left + dw, (int)dst->width);
+            if (x0 >= x1 || s->src_x < 0 || s->src_y < 0 ||
+                s->src_x + sw > atlas->width || s->src_y + sh > atlas->height)
+                continue;
+
+            int n      = x1 - x0;
+            int off    = x0 - left;
+            uint32_t *dst_row       = &dst->pixels[dy * dst->pitch + x0];
+            const uint32_t *src_row = &atlas->pixels[(s->src_y + r) * atlas->pitch + s->src_x];
+
+            if (!atlas->opaque) {
+                for (int c0 = 0; c0 < n; c0 += PICASSO_MAP_STACK) {
+                    int m = PICASSO_MIN(n - c0, PICASSO_MAP_STACK);
+                    for (int c = 0; c < m; ++c) row[c] = src_row[cols[off + c0 + c]];
+                    picasso_blend_span_premultiplied(dst_row + c0, row, m);
+                }
+            }
+            else if (repeat) {
+                memcpy(dst_row, dst_row - dst->pitch, (size_t)n * sizeof(uint32_t));
+            }
+            else {
+                picasso__copy_row(dst_row, src_row, cols + off, n, ratio,
+                                  ratio ? off % ratio : 0);
+            }
+        }
+    }
+}
+
+void picasso_blit_batch(picasso_backbuffer *dst, const picasso_sprite_batch *batch)
+{
+    if (!dst || !dst->pixels || !batch || !batch->sprites || !batch->atlas ||
+        !batch->atlas->pixels) return;
+
+    int dw = batch->dst_width, dh = batch->dst_height;
+    int sw = batch->src_width, sh = batch->src_height;
+    if (dw <= 0 || dh <= 0 || sw <= 0 || sh <= 0) return;
+
+    // The scale setup of picasso_blit_texture, once for every sprite
+    int stack_cols[PICASSO_MAP_STACK], stack_rows[PICASSO_MAP_STACK];
+    int *cols = dw <= PICASSO_MAP_STACK ? stack_cols : picasso_malloc((size_t)dw * sizeof(int));
+    int *rows = dh <= PICASSO_MAP_STACK ? stack_rows : picasso_malloc((size_t)dh * sizeof(int));
+
+    if (cols && rows) {
+        picasso__stepper xs = picasso__stepper_init(0, sw, dw, 0);
+        picasso__stepper ys = picasso__stepper_init(0, sh, dh, 0);
+        for (int i = 0; i < dw; ++i) cols[i] = picasso__stepper_next(&xs);
+        for (int i = 0; i < dh; ++i) rows[i] = picasso__stepper_next(&ys);
+
+        int ratio = dw % sw == 0 ? dw / sw : 0;
+
+        // Runs of sprites on one row, left to right without overlapping
+        const picasso_sprite *sprites = batch->sprites;
+        for (int i = 0; i < batch->count; ) {
+            int end = i + 1;
+            while (end < batch->count && sprites[end].dst_y == sprites[i].dst_y &&
+                   sprites[end].dst_x >= sprites[end - 1].dst_x + dw)
+                ++end;
+
+            picasso__blit_strip(dst, batch, cols, rows, ratio, i, end);
+            i = end;
+        }
+    }
+
+    if (cols != stack_cols) picasso_free(cols);
+    if (rows != stack_rows) picasso_free(rows);
+}
 
-            uint8_t *src_pixel = &src->pixels[sy * src->row_stride + sx * src->channels];
-            color c = get_color(src_pixel, src->channels);
-            if (src->channels == 3) PICASSO_SWAP(c.r, c.b); // RGB → BGR
+// --------------------------------------------------------
+// Sprite caches
+// --------------------------------------------------------
 
-            uint32_t rgba = color_to_u32(c);
-            dst->pixels[dy * dst->width + dx] = picasso__blend_pixel(
-                                                    dst->pixels[dy * dst->width + dx],
-                                                    rgba);
+/* Scales one source rect into the cache slot at x. The pixels are copied,
+ * not blended, so blending later out of the cache gives what blending out
+ * of the atlas would. Columns outside the atlas stay transparent */
+static void picasso__cache_sprite(picasso_texture *tex, const picasso_texture *atlas,
+                                  picasso_rect src, int x, int width, int height)
+{
+    picasso__stepper ys = picasso__stepper_init(src.y, src.height, height, 0);
+
+    for (int dy = 0; dy < height; ++dy) {
+        int sy = picasso__stepper_next(&ys);
+        uint32_t *dst_row = &tex->pixels[dy * tex->pitch + x];
+        picasso__stepper xs = picasso__stepper_init(src.x, src.width, width, 0);
+
+        for (int dx = 0; dx < width; ++dx) {
+            int sx = picasso__stepper_next(&xs);
+            bool inside = sx >= 0 && sx < atlas->width && sy >= 0 && sy < atlas->height;
+            dst_row[dx] = inside ? atlas->pixels[sy * atlas->pitch + sx] : 0;
+            if (!inside) tex->opaque = false;
         }
     }
 }
+
+bool picasso_update_sprite_cache(picasso_sprite_cache *cache, const picasso_texture *atlas,
+                                 const picasso_rect *sources, int count,
+                                 int width, int height)
+{
+    if (!cache) return false;
+
+    if (cache->texture && cache->atlas == atlas && cache->count == count &&
+        cache->width == width && cache->height == height)
+        return true;
+
+    picasso_free_sprite_cache(cache);
+    if (!atlas || !atlas->pixels || !sources || count <= 0 || width <= 0 || height <= 0)
+        return false;
+
+    for (int i = 0; i < count; ++i)
+        if (sources[i].width <= 0 || sources[i].height <= 0) return false;
+
+    picasso_texture *tex = picasso_malloc(sizeof(picasso_texture));
+    if (!tex) return false;
+
+    tex->width  = width * count;
+    tex->height = height;
+    tex->pitch  = tex->width;
+    tex->opaque = atlas->opaque;
+    tex->pixels = picasso_malloc((size_t)tex->pitch * tex->height * sizeof(uint32_t));
+    if (!tex->pixels) {
+        ERROR("Out of memory caching %d sprites of %dx%d", count, width, height);
+        picasso_free(tex);
+        return false;
+    }
+
+    for (int i = 0; i < count; ++i)
+        picasso__cache_sprite(tex, atlas, sources[i], i * width, width, height);
+
+    *cache = (picasso_sprite_cache){ tex, atlas, width, height, count };
+    TRACE("Cached %d sprites at %dx%d", count, width, height);
+    return true;
+}
+
+void picasso_free_sprite_cache(picasso_sprite_cache *cache)
+{
+    if (!cache) return;
+    picasso_free_texture(cache->texture);
+    *cache = (picasso_sprite_cache){0};
+}
+
 void picasso_copy(picasso_image *src, picasso_image *dst)
 {
     for (int y = 0; y < dst->height; ++y) {
@@ -470,6 +1131,27 @@ void* picasso_backbuffer_pixels(picasso_backbuffer* bf)
     return (void*)bf->pixels;
 }
 
+int picasso_get_damage(const picasso_backbuffer *bf, const picasso_rect **rects)
+{
+    if (!bf) return 0;
+    if (rects) *rects = bf->damage;
+    return bf->damage_count;
+}
+
+void picasso_clear_damage(picasso_backbuffer *bf)
+{
+    if (bf) bf->damage_count = 0;
+}
+
+void picasso_add_damage(picasso_backbuffer *bf, picasso_rect r)
+{
+    if (!bf) return;
+
+    picasso_draw_bounds bounds;
+    picasso__normalize_rect(&r);
+    if (picasso__clip_rect_to_bounds(bf, &r, &bounds)) picasso__damage(bf, bounds);
+}
+
 void picasso_clear_backbuffer(picasso_backbuffer* bf)
 {
     if (!bf || !bf->pixels) {
@@ -477,9 +1159,81 @@ void picasso_clear_backbuffer(picasso_backbuffer* bf)
         return;
     }
 
-    for (size_t i = 0; i <  bf->width * bf->height; ++i) {
-        bf->pixels[i] = color_to_u32(CLEAR_BACKGROUND);
+    // Row by row, a view into a larger buffer skips the rest of each row
+    uint32_t clear = color_to_u32(CLEAR_BACKGROUND);
+    for (size_t y = 0; y < bf->height; ++y) {
+        uint32_t *row = &bf->pixels[y * bf->pitch];
+        for (size_t x = 0; x < bf->width; ++x) row[x] = clear;
     }
+    picasso__damage(bf, (picasso_draw_bounds){ 0, 0, bf->width, bf->height });
+}
+
+// --------------------------------------------------------
+// Layers
+// --------------------------------------------------------
+
+/* Starts out cleared, so a partly covered layer still looks like a
+ * cleared backbuffer underneath */
+picasso_backbuffer *picasso_create_layer(int width, int height)
+{
+    picasso_backbuffer *layer = picasso_create_backbuffer(width, height);
+    if (layer) picasso_clear_backbuffer(layer);
+    return layer;
+}
+
+/* Copies rows of the layer in r, clipped to both buffers */
+void picasso_draw_layer_rect(picasso_backbuffer *dst, const picasso_backbuffer *layer,
+                             picasso_rect r)
+{
+    if (!dst || !layer || !dst->pixels || !layer->pixels) return;
+
+    picasso__normalize_rect(&r);
+
+    picasso_draw_bounds bounds;
+    if (!picasso__clip_rect_to_bounds(dst, &r, &bounds)) return;
+    bounds.x1 = PICASSO_MIN(bounds.x1, (int)layer->width);
+    bounds.y1 = PICASSO_MIN(bounds.y1, (int)layer->height);
+    if (bounds.x0 >= bounds.x1) return;
+    picasso__damage(dst, bounds);
+
+    size_t bytes = (size_t)(bounds.x1 - bounds.x0) * sizeof(uint32_t);
+    for (int y = bounds.y0; y < bounds.y1; ++y) {
+        memcpy(&dst->pixels[y * dst->pitch + bounds.x0],
+               &layer->pixels[y * layer->pitch + bounds.x0], bytes);
+    }
+}
+
+void picasso_draw_layer(picasso_backbuffer *dst, const picasso_backbuffer *layer,
+                        const picasso_rect *overdrawn)
+{
+    if (!dst || !layer || !dst->pixels || !layer->pixels) return;
+
+    int width  = (int)PICASSO_MIN(dst->width, layer->width);
+    int height = (int)PICASSO_MIN(dst->height, layer->height);
+
+    // One copy for the whole layer when the buffers line up
+    if (!overdrawn && dst->width == layer->width && dst->pitch == layer->pitch &&
+        layer->pitch == layer->width)
+    {
+        memcpy(dst->pixels, layer->pixels,
+               (size_t)height * layer->pitch * sizeof(uint32_t));
+        picasso__damage(dst, (picasso_draw_bounds){ 0, 0, width, height });
+        return;
+    }
+
+    picasso_rect skip = overdrawn ? *overdrawn : (picasso_rect){0};
+    picasso__normalize_rect(&skip);
+
+    // Bands above and below the skipped region, then its left and right
+    int top    = PICASSO_CLAMP(skip.y, 0, height);
+    int bottom = PICASSO_CLAMP(skip.y + skip.height, top, height);
+    int left   = PICASSO_CLAMP(skip.x, 0, width);
+    int right  = PICASSO_CLAMP(skip.x + skip.width, left, width);
+
+    picasso_draw_layer_rect(dst, layer, (picasso_rect){ 0, 0, width, top });
+    picasso_draw_layer_rect(dst, layer, (picasso_rect){ 0, bottom, width, height - bottom });
+    picasso_draw_layer_rect(dst, layer, (picasso_rect){ 0, top, left, bottom - top });
+    picasso_draw_layer_rect(dst, layer, (picasso_rect){ right, top, width - right, bottom - top });
 }
 
 // --------------------------------------------------------
@@ -491,14 +1245,13 @@ void picasso_fill_rect(picasso_backbuffer *bf, picasso_rect *r, color c)
     picasso_draw_bounds bounds = {0};
     picasso__normalize_rect(r);
     if(!picasso__clip_rect_to_bounds(bf, r, &bounds)) return;
+    picasso__damage(bf, bounds);
 
     uint32_t new_pixel = color_to_u32(c);
 
     for (int y = bounds.y0; y < bounds.y1; ++y) {
-        for (int x = bounds.x0; x < bounds.x1; ++x) {
-            uint32_t *cur_pixel = &bf->pixels[y * bf->width + x];
-            *cur_pixel = picasso__blend_pixel(*cur_pixel, new_pixel);
-        }
+        picasso_blend_span_color(&bf->pixels[y * bf->pitch + bounds.x0],
+                                 new_pixel, bounds.x1 - bounds.x0);
     }
 }
 
@@ -523,6 +1276,7 @@ void picasso_draw_rect(picasso_backbuffer *bf, picasso_rect *outer, int thicknes
 
     // Clip to draw bounds
     if (!picasso__clip_rect_to_bounds(bf, outer, &outer_bounds)) return;
+    picasso__damage(bf, outer_bounds);
 
     if (!picasso__clip_rect_to_bounds(bf, &inner, &inner_bounds)) {
         inner_bounds = (picasso_draw_bounds){0};
@@ -531,18 +1285,20 @@ void picasso_draw_rect(picasso_backbuffer *bf, picasso_rect *outer, int thicknes
     uint32_t new_pixel = color_to_u32(c);
 
     for (int y = outer_bounds.y0; y < outer_bounds.y1; ++y) {
-        for (int x = outer_bounds.x0; x < outer_bounds.x1; ++x) {
-
-            bool inside_inner = (
-                    y >= inner_bounds.y0 && y < inner_bounds.y1 &&
-                    x >= inner_bounds.x0 && x < inner_bounds.x1
-                    );
-
-            if (inside_inner) continue;
-            else {
-                uint32_t *cur_pixel = &bf->pixels[y * bf->width + x];
-                *cur_pixel = picasso__blend_pixel(*cur_pixel, new_pixel);
-            }
+        uint32_t *row = &bf->pixels[y * bf->pitch];
+
+        bool crosses_inner = y >= inner_bounds.y0 && y < inner_bounds.y1 &&
+                             inner_bounds.x0 < inner_bounds.x1;
+
+        // Rows through the hole blend the two sides, the rest blend whole
+        if (crosses_inner) {
+            picasso_blend_span_color(row + outer_bounds.x0, new_pixel,
+                                     inner_bounds.x0 - outer_bounds.x0);
+            picasso_blend_span_color(row + inner_bounds.x1, new_pixel,
+                                     outer_bounds.x1 - inner_bounds.x1);
+        } else {
+            picasso_blend_span_color(row + outer_bounds.x0, new_pixel,
+                                     outer_bounds.x1 - outer_bounds.x0);
         }
     }
 }
@@ -568,17 +1324,24 @@ void picasso_fill_circle(picasso_backbuffer *bf, int x0, int y0, int radius, col
     picasso_draw_bounds bounds = {0};
     picasso_rect circle_box = picasso__make_circle_bounds(x0, y0, radius);
     if(!picasso__clip_rect_to_bounds(bf, &circle_box, &bounds)) return;
+    picasso__damage(bf, bounds);
 
     uint32_t new_pixel = color_to_u32(c);
 
-    // a^2 + b^2 = c^2
+    // a^2 + b^2 = c^2, blended in runs of covered pixels
     for (int y = bounds.y0; y < bounds.y1; ++y) {
-        for (int x = bounds.x0; x < bounds.x1; ++x) {
+        uint32_t *row = &bf->pixels[y * bf->pitch];
+        int run = -1;
+
+        for (int x = bounds.x0; x <= bounds.x1; ++x) {
             int dx = x - x0;
             int dy = y - y0;
-            if((dx*dx + dy*dy <= radius*radius + radius)){
-                uint32_t *cur_pixel = &bf->pixels[y * bf->width + x];
-                *cur_pixel = picasso__blend_pixel(*cur_pixel, new_pixel);
+            bool inside = x < bounds.x1 && dx*dx + dy*dy <= radius*radius + radius;
+
+            if (inside && run < 0) run = x;
+            if (!inside && run >= 0) {
+                picasso_blend_span_color(row + run, new_pixel, x - run);
+                run = -1;
             }
         }
     }
@@ -588,6 +1351,7 @@ void picasso_draw_circle(picasso_backbuffer *bf, int x0, int y0, int radius,int
     picasso_draw_bounds bounds = {0};
     picasso_rect circle_box = picasso__make_circle_bounds(x0, y0, radius);
     if (!picasso__clip_rect_to_bounds(bf, &circle_box, &bounds)) return;
+    picasso__damage(bf, bounds);
 
     uint32_t new_pixel = color_to_u32(c);
 
@@ -595,14 +1359,20 @@ void picasso_draw_circle(picasso_backbuffer *bf, int x0, int y0, int radius,int
     int inner = (radius - thickness) * (radius - thickness);
 
     for (int y = bounds.y0; y < bounds.y1; ++y) {
-        for (int x = bounds.x0; x < bounds.x1; ++x) {
+        uint32_t *row = &bf->pixels[y * bf->pitch];
+        int run = -1;
+
+        for (int x = bounds.x0; x <= bounds.x1; ++x) {
             int dx = x - x0;
             int dy = y - y0;
             int dist2 = dx * dx + dy * dy;
+            bool inside = x < bounds.x1 &&
+                          dist2 >= inner+radius && dist2 <= outer+radius;
 
-            if (dist2 >= inner+radius && dist2 <= outer+radius) {
-                uint32_t *cur_pixel = &bf->pixels[y * bf->width + x];
-                *cur_pixel = picasso__blend_pixel(*cur_pixel, new_pixel);
+            if (inside && run < 0) run = x;
+            if (!inside && run >= 0) {
+                picasso_blend_span_color(row + run, new_pixel, x - run);
+                run = -1;
             }
         }
     }
@@ -611,6 +1381,12 @@ void picasso_draw_line(picasso_backbuffer *bf, int x0, int y0, int x1, int y1, c
 {
     uint32_t new_pixel = color_to_u32(c);
 
+    // Rows only step down from y0, and never past y1
+    picasso_draw_bounds bounds;
+    picasso_rect line_box = { x0, y0, x1 - x0, PICASSO_MAX(y1 - y0, 0) + 1 };
+    if (x1 > x0 && picasso__clip_rect_to_bounds(bf, &line_box, &bounds))
+        picasso__damage(bf, bounds);
+
     /* Bresenhams lines algorithm
      * */
     int dx = x1-x0;
@@ -618,7 +1394,7 @@ void picasso_draw_line(picasso_backbuffer *bf, int x0, int y0, int x1, int y1, c
     int D = 2*dy-dx;
     int y = y0;
     for(int i = x0; i < x1; ++i){
-        bf->pixels[y*bf->width + i] = new_pixel;
+        bf->pixels[y*bf->pitch + i] = new_pixel;
         if (D > 0) {
             y++;
             D -= 2*dx;
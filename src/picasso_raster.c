@@ -0,0 +1,385 @@
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <blackbox.h>
+
+#include "picasso.h"
+
+// --------------------------------------------------------
+// Command lists
+// --------------------------------------------------------
+
+picasso_command_list *picasso_create_command_list(void)
+{
+    return picasso_calloc(1, sizeof(picasso_command_list));
+}
+
+void picasso_destroy_command_list(picasso_command_list *list)
+{
+    if (!list) return;
+    picasso_free(list->commands);
+    picasso_free(list->sprites);
+    picasso_free(list);
+}
+
+void picasso_reset_command_list(picasso_command_list *list)
+{
+    if (!list) return;
+    list->count        = 0;
+    list->sprite_count = 0;
+}
+
+static void picasso__push_command(picasso_command_list *list, picasso_command cmd)
+{
+    if (!list) return;
+
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 256;
+        picasso_command *grown = picasso_realloc(list->commands,
+                                                 (size_t)capacity * sizeof(picasso_command));
+        if (!grown) {
+            ERROR("Out of memory recording a draw command");
+            return;
+        }
+        list->commands = grown;
+        list->capacity = capacity;
+    }
+
+    list->commands[list->count++] = cmd;
+}
+
+void picasso_cmd_clear(picasso_command_list *list)
+{
+    picasso__push_command(list, (picasso_command){ .type = PICASSO_CMD_CLEAR });
+}
+
+void picasso_cmd_fill_rect(picasso_command_list *list, picasso_rect r, color c)
+{
+    picasso__push_command(list, (picasso_command){
+        .type = PICASSO_CMD_FILL_RECT, .rect = { r, 0, c } });
+}
+
+void picasso_cmd_draw_rect(picasso_command_list *list, picasso_rect r, int thickness, color c)
+{
+    picasso__push_command(list, (picasso_command){
+        .type = PICASSO_CMD_DRAW_RECT, .rect = { r, thickness, c } });
+}
+
+void picasso_cmd_fill_circle(picasso_command_list *list, int x0, int y0, int radius, color c)
+{
+    picasso__push_command(list, (picasso_command){
+        .type = PICASSO_CMD_FILL_CIRCLE, .circle = { x0, y0, radius, 0, c } });
+}
+
+void picasso_cmd_draw_circle(picasso_command_list *list, int x0, int y0, int radius,
+                             int thickness, color c)
+{
+    picasso__push_command(list, (picasso_command){
+        .type = PICASSO_CMD_DRAW_CIRCLE, .circle = { x0, y0, radius, thickness, c } });
+}
+
+void picasso_cmd_blit_texture(picasso_command_list *list, const picasso_texture *src,
+                              picasso_rect src_rect, picasso_rect dst_rect)
+{
+    picasso__push_command(list, (picasso_command){
+        .type = PICASSO_CMD_BLIT_TEXTURE, .blit = { src, src_rect, dst_rect } });
+}
+
+void picasso_cmd_draw_layer_rect(picasso_command_list *list, const picasso_backbuffer *layer,
+                                 picasso_rect r)
+{
+    picasso__push_command(list, (picasso_command){
+        .type = PICASSO_CMD_DRAW_LAYER, .layer = { layer, r } });
+}
+
+/* The sprites are copied, the caller's array can change after recording.
+ * The command refers to them by index since the array may still move */
+void picasso_cmd_blit_batch(picasso_command_list *list, const picasso_sprite_batch *batch)
+{
+    if (!list || !batch || !batch->sprites || batch->count <= 0) return;
+
+    if (list->sprite_count + batch->count > list->sprite_capacity) {
+        int capacity = list->sprite_capacity ? list->sprite_capacity : 1024;
+        while (capacity < list->sprite_count + batch->count) capacity *= 2;
+
+        picasso_sprite *grown = picasso_realloc(list->sprites,
+                                                (size_t)capacity * sizeof(picasso_sprite));
+        if (!grown) {
+            ERROR("Out of memory recording a sprite batch");
+            return;
+        }
+        list->sprites         = grown;
+        list->sprite_capacity = capacity;
+    }
+
+    int first = list->sprite_count;
+    memcpy(&list->sprites[first], batch->sprites, (size_t)batch->count * sizeof(picasso_sprite));
+    list->sprite_count += batch->count;
+
+    picasso_command cmd = { .type = PICASSO_CMD_BLIT_BATCH, .batch = { *batch, first } };
+    cmd.batch.batch.sprites = NULL;
+    picasso__push_command(list, cmd);
+}
+
+// --------------------------------------------------------
+// Running commands
+// --------------------------------------------------------
+
+/* Pixels a command may cover on the whole buffer, also used as its damage.
+ * Circles use the same box as their draw calls */
+static picasso_rect picasso__command_box(const picasso_command *cmd,
+                                         const picasso_backbuffer *dst)
+{
+    int overshoot = PICASSO_CIRCLE_DEFAULT_TOLERANCE + 1;
+
+    switch (cmd->type) {
+        case PICASSO_CMD_CLEAR:
+            return (picasso_rect){ 0, 0, (int)dst->width, (int)dst->height };
+        case PICASSO_CMD_FILL_RECT:
+        case PICASSO_CMD_DRAW_RECT:
+            return cmd->rect.r;
+        case PICASSO_CMD_FILL_CIRCLE:
+        case PICASSO_CMD_DRAW_CIRCLE: {
+            int extent = cmd->circle.radius + overshoot;
+            return (picasso_rect){ cmd->circle.x0 - extent, cmd->circle.y0 - extent,
+                                   extent * 2 + 1, extent * 2 + 1 };
+        }
+        case PICASSO_CMD_BLIT_TEXTURE:
+            return cmd->blit.dst;
+        case PICASSO_CMD_DRAW_LAYER:
+            return cmd->layer.r;
+        case PICASSO_CMD_BLIT_BATCH:
+            break; // every sprite has its own box
+    }
+    return (picasso_rect){0};
+}
+
+static picasso_rect picasso__sprite_box(const picasso_command_list *list,
+                                        const picasso_command *cmd, int i)
+{
+    const picasso_sprite_batch *batch = &cmd->batch.batch;
+    const picasso_sprite *s = &list->sprites[cmd->batch.first + i];
+    return (picasso_rect){ s->dst_x + batch->offset_x, s->dst_y + batch->offset_y,
+                           batch->dst_width, batch->dst_height };
+}
+
+/* Runs every command on rows [y0, y1). The band is a backbuffer starting
+ * at row y0, and commands move up by y0 to match, so the draw calls clip
+ * to the band themselves. Scaled blits step from where the clipped rect
+ * starts, so a band draws the same pixels the whole buffer would */
+static void picasso__run_band(picasso_backbuffer *dst, const picasso_command_list *list,
+                              int y0, int y1)
+{
+    picasso_backbuffer band = {
+        .pixels = dst->pixels + (size_t)y0 * dst->pitch,
+        .width  = dst->width,
+        .height = (uint32_t)(y1 - y0),
+        .pitch  = dst->pitch,
+    };
+
+    for (int i = 0; i < list->count; ++i) {
+        picasso_command cmd = list->commands[i];
+
+        switch (cmd.type) {
+            case PICASSO_CMD_CLEAR:
+                picasso_clear_backbuffer(&band);
+                break;
+            case PICASSO_CMD_FILL_RECT:
+                cmd.rect.r.y -= y0;
+                picasso_fill_rect(&band, &cmd.rect.r, cmd.rect.c);
+                break;
+            case PICASSO_CMD_DRAW_RECT:
+                cmd.rect.r.y -= y0;
+                picasso_draw_rect(&band, &cmd.rect.r, cmd.rect.thickness, cmd.rect.c);
+                break;
+            case PICASSO_CMD_FILL_CIRCLE:
+                picasso_fill_circle(&band, cmd.circle.x0, cmd.circle.y0 - y0,
+                                    cmd.circle.radius, cmd.circle.c);
+                break;
+            case PICASSO_CMD_DRAW_CIRCLE:
+                picasso_draw_circle(&band, cmd.circle.x0, cmd.circle.y0 - y0,
+                                    cmd.circle.radius, cmd.circle.thickness, cmd.circle.c);
+                break;
+            case PICASSO_CMD_BLIT_TEXTURE:
+                cmd.blit.dst.y -= y0;
+                picasso_blit_texture(&band, cmd.blit.tex, cmd.blit.src, cmd.blit.dst);
+                break;
+            case PICASSO_CMD_DRAW_LAYER: {
+                const picasso_backbuffer *layer = cmd.layer.layer;
+                if (!layer || (int)layer->height <= y0) break;
+
+                // The layer lines up with the buffer, so it moves with the band
+                picasso_backbuffer layer_band = {
+                    .pixels = layer->pixels + (size_t)y0 * layer->pitch,
+                    .width  = layer->width,
+                    .height = layer->height - (uint32_t)y0,
+                    .pitch  = layer->pitch,
+                };
+                cmd.layer.r.y -= y0;
+                picasso_draw_layer_rect(&band, &layer_band, cmd.layer.r);
+                break;
+            }
+            case PICASSO_CMD_BLIT_BATCH:
+                cmd.batch.batch.sprites   = &list->sprites[cmd.batch.first];
+                cmd.batch.batch.offset_y -= y0;
+                picasso_blit_batch(&band, &cmd.batch.batch);
+                break;
+        }
+    }
+}
+
+// --------------------------------------------------------
+// Rasterizer
+// --------------------------------------------------------
+
+typedef struct {
+    picasso_rasterizer *r;
+    int index;
+} picasso__worker_arg;
+
+/* The caller draws band 0 and the workers the rest. A new generation
+ * starts the workers, and the last one done wakes the caller */
+struct picasso_rasterizer {
+    int threads;                // including the caller
+    pthread_t workers[PICASSO_RASTER_MAX_THREADS];
+    picasso__worker_arg args[PICASSO_RASTER_MAX_THREADS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    int pending;
+    bool quit;
+
+    // Current job, fixed while a generation runs
+    picasso_backbuffer *dst;
+    const picasso_command_list *list;
+    int bands;
+};
+
+static void picasso__band_rows(int height, int bands, int index, int *y0, int *y1)
+{
+    *y0 = (int)((int64_t)height * index / bands);
+    *y1 = (int)((int64_t)height * (index + 1) / bands);
+}
+
+static void *picasso__worker(void *arg)
+{
+    picasso_rasterizer *r = ((picasso__worker_arg*)arg)->r;
+    int index             = ((picasso__worker_arg*)arg)->index;
+    uint64_t seen         = 0;
+
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (!r->quit && r->generation == seen)
+            pthread_cond_wait(&r->start, &r->lock);
+        if (r->quit) break;
+        seen = r->generation;
+
+        int bands = r->bands;
+        picasso_backbuffer *dst = r->dst;
+        const picasso_command_list *list = r->list;
+        pthread_mutex_unlock(&r->lock);
+
+        if (index < bands) {
+            int y0, y1;
+            picasso__band_rows((int)dst->height, bands, index, &y0, &y1);
+            picasso__run_band(dst, list, y0, y1);
+        }
+
+        pthread_mutex_lock(&r->lock);
+        if (--r->pending == 0) pthread_cond_signal(&r->done);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+picasso_rasterizer *picasso_create_rasterizer(int threads)
+{
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    threads = PICASSO_CLAMP(threads, 1, PICASSO_RASTER_MAX_THREADS);
+
+    picasso_rasterizer *r = picasso_calloc(1, sizeof(picasso_rasterizer));
+    if (!r) return NULL;
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->start, NULL);
+    pthread_cond_init(&r->done, NULL);
+
+    // Fewer workers than asked is still a working rasterizer
+    r->threads = 1;
+    for (int i = 1; i < threads; ++i) {
+        r->args[i] = (picasso__worker_arg){ r, i };
+        if (pthread_create(&r->workers[i], NULL, picasso__worker, &r->args[i]) != 0) {
+            WARN("Could only start %d of %d raster threads", r->threads, threads);
+            break;
+        }
+        r->threads++;
+    }
+
+    INFO("Rasterizer running on %d threads", r->threads);
+    return r;
+}
+
+void picasso_destroy_rasterizer(picasso_rasterizer *r)
+{
+    if (!r) return;
+
+    pthread_mutex_lock(&r->lock);
+    r->quit = true;
+    pthread_cond_broadcast(&r->start);
+    pthread_mutex_unlock(&r->lock);
+
+    for (int i = 1; i < r->threads; ++i) pthread_join(r->workers[i], NULL);
+
+    pthread_cond_destroy(&r->done);
+    pthread_cond_destroy(&r->start);
+    pthread_mutex_destroy(&r->lock);
+    picasso_free(r);
+}
+
+void picasso_rasterize(picasso_rasterizer *r, picasso_backbuffer *dst,
+                       const picasso_command_list *list)
+{
+    if (!dst || !dst->pixels || !list || list->count == 0) return;
+
+    // Damage is recorded on the whole buffer, the bands keep their own
+    int64_t covered = 0;
+    for (int i = 0; i < list->count; ++i) {
+        const picasso_command *cmd = &list->commands[i];
+        int boxes = cmd->type == PICASSO_CMD_BLIT_BATCH ? cmd->batch.batch.count : 1;
+
+        for (int j = 0; j < boxes; ++j) {
+            picasso_rect box = cmd->type == PICASSO_CMD_BLIT_BATCH
+                             ? picasso__sprite_box(list, cmd, j)
+                             : picasso__command_box(cmd, dst);
+            picasso_add_damage(dst, box);
+            covered += (int64_t)PICASSO_ABS(box.width) * PICASSO_ABS(box.height);
+        }
+    }
+
+    int bands = r ? PICASSO_MIN(r->threads, (int)dst->height) : 1;
+    if (covered < PICASSO_RASTER_MIN_PIXELS) bands = 1;
+
+    if (bands == 1) {
+        picasso__run_band(dst, list, 0, (int)dst->height);
+        return;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    r->dst     = dst;
+    r->list    = list;
+    r->bands   = bands;
+    r->pending = r->threads - 1;
+    r->generation++;
+    pthread_cond_broadcast(&r->start);
+    pthread_mutex_unlock(&r->lock);
+
+    int y0, y1;
+    picasso__band_rows((int)dst->height, bands, 0, &y0, &y1);
+    picasso__run_band(dst, list, y0, y1);
+
+    pthread_mutex_lock(&r->lock);
+    while (r->pending > 0) pthread_cond_wait(&r->done, &r->lock);
+    pthread_mutex_unlock(&r->lock);
+}
@@ -0,0 +1,415 @@
+/*******************************************************************************
+ * Picasso checks
+ *
+ * Runs the fast raster paths against the plain ones they replace and fails
+ * on the first difference:
+ *
+ *     blend spans          SIMD kernels against the scalar per pixel blend
+ *     texture blits        scaled opaque blits against picasso_blit_rect,
+ *                          translucent ones within 1 of straight alpha
+ *     sprite batches       against one picasso_blit_texture per sprite
+ *     rasterizer           one worker against several, and against drawing
+ *                          the same calls directly
+ *
+ * Built and run by `make headless`.
+ *******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "picasso.h"
+
+static int failures;
+
+#define CHECK(cond, ...) do {                                   \
+    if (!(cond)) {                                              \
+        fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);    \
+        fprintf(stderr, __VA_ARGS__);                           \
+        fputc('\n', stderr);                                    \
+        failures++;                                             \
+        return;                                                 \
+    }                                                           \
+} while (0)
+
+static uint32_t rng_state = 0x2545F491u;
+
+static uint32_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static int rng_range(int n) { return (int)(rng_next() % (uint32_t)n); }
+
+// Alpha mostly at the ends, where the kernels take their shortcuts
+static uint8_t rng_alpha(void)
+{
+    switch (rng_range(4)) {
+        case 0:  return 0;
+        case 1:  return 255;
+        default: return (uint8_t)rng_next();
+    }
+}
+
+static uint32_t rng_pixel(void)
+{
+    return ((uint32_t)rng_alpha() << 24) | (rng_next() & 0xFFFFFF);
+}
+
+//----------------------------------------
+// Reference blends, written out plainly
+//----------------------------------------
+
+static uint32_t blend_straight(uint32_t dst, uint32_t src)
+{
+    uint32_t sa = src >> 24, inv = 255 - sa, out = 0xFFu << 24;
+    if (sa == 255) return src;
+    if (sa == 0) return dst;
+
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t s = (src >> shift) & 0xFF, d = (dst >> shift) & 0xFF;
+        out |= ((s * sa + d * inv) / 255) << shift;
+    }
+    return out;
+}
+
+static uint32_t blend_premultiplied(uint32_t dst, uint32_t src)
+{
+    uint32_t sa = src >> 24, inv = 255 - sa, out = 0xFFu << 24;
+    if (sa == 255) return src;
+    if (sa == 0) return dst;
+
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t s = (src >> shift) & 0xFF, d = (dst >> shift) & 0xFF;
+        out |= (s + (d * inv + 127) / 255) << shift;
+    }
+    return out;
+}
+
+// As picasso_texture_from_image stores a pixel
+static uint32_t premultiply(uint32_t p)
+{
+    uint32_t a = p >> 24, out = a << 24;
+    if (a == 255) return p;
+
+    for (int shift = 0; shift < 24; shift += 8)
+        out |= ((((p >> shift) & 0xFF) * a + 127) / 255) << shift;
+    return out;
+}
+
+static int channel_distance(uint32_t a, uint32_t b)
+{
+    int most = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        int d = abs((int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF));
+        if (d > most) most = d;
+    }
+    return most;
+}
+
+//----------------------------------------
+// Helpers
+//----------------------------------------
+
+static picasso_image *random_image(int width, int height, bool opaque)
+{
+    picasso_image *img = picasso_alloc_image(width, height, 4);
+    if (!img) return NULL;
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t *p = &img->pixels[y * img->row_stride + x * 4];
+            p[0] = (uint8_t)rng_next();
+            p[1] = (uint8_t)rng_next();
+            p[2] = (uint8_t)rng_next();
+            p[3] = opaque ? 255 : rng_alpha();
+        }
+    }
+    return img;
+}
+
+static void fill_random(picasso_backbuffer *bf)
+{
+    for (uint32_t y = 0; y < bf->height; y++)
+        for (uint32_t x = 0; x < bf->width; x++)
+            bf->pixels[y * bf->pitch + x] = 0xFF000000u | rng_next();
+}
+
+static bool same_pixels(const picasso_backbuffer *a, const picasso_backbuffer *b)
+{
+    for (uint32_t y = 0; y < a->height; y++) {
+        if (memcmp(&a->pixels[y * a->pitch], &b->pixels[y * b->pitch],
+                   a->width * sizeof(uint32_t)) != 0)
+            return false;
+    }
+    return true;
+}
+
+static picasso_rect random_rect(int width, int height)
+{
+    return (picasso_rect){ rng_range(width + 80) - 40, rng_range(height + 80) - 40,
+                           rng_range(160) - 20, rng_range(160) - 20 };
+}
+
+static color random_color(void)
+{
+    return (color){ (uint8_t)rng_next(), (uint8_t)rng_next(),
+                    (uint8_t)rng_next(), rng_alpha() };
+}
+
+//----------------------------------------
+// Checks
+//----------------------------------------
+
+/* Odd lengths and offsets so every kernel width and the scalar tail run */
+static void check_blend_spans(void)
+{
+    enum { LEN = 1031 };
+    uint32_t dst[LEN], src[LEN], out[LEN];
+
+    for (int round = 0; round < 200; round++) {
+        int start = rng_range(16), count = rng_range(LEN - start);
+        for (int i = 0; i < LEN; i++) {
+            dst[i] = 0xFF000000u | rng_next();
+            src[i] = rng_pixel();
+        }
+
+        memcpy(out, dst, sizeof(out));
+        picasso_blend_span(out + start, src + start, count);
+        for (int i = start; i < start + count; i++)
+            CHECK(out[i] == blend_straight(dst[i], src[i]),
+                  "blend_span pixel %d: %08x over %08x gave %08x", i,
+                  src[i], dst[i], out[i]);
+
+        for (int i = 0; i < LEN; i++) src[i] = premultiply(src[i]);
+        memcpy(out, dst, sizeof(out));
+        picasso_blend_span_premultiplied(out + start, src + start, count);
+        for (int i = start; i < start + count; i++)
+            CHECK(out[i] == blend_premultiplied(dst[i], src[i]),
+                  "blend_span_premultiplied pixel %d: %08x over %08x gave %08x",
+                  i, src[i], dst[i], out[i]);
+
+        uint32_t c = rng_pixel();
+        memcpy(out, dst, sizeof(out));
+        picasso_blend_span_color(out + start, c, count);
+        for (int i = start; i < start + count; i++)
+            CHECK(out[i] == blend_straight(dst[i], c),
+                  "blend_span_color pixel %d: %08x over %08x gave %08x", i,
+                  c, dst[i], out[i]);
+    }
+}
+
+/* Premultiplying at load rounds once more than blending straight alpha */
+static void check_premultiplied_rounding(void)
+{
+    for (int round = 0; round < 1 << 20; round++) {
+        uint32_t src = rng_pixel(), dst = 0xFF000000u | rng_next();
+        uint32_t straight = blend_straight(dst, src);
+        uint32_t premul   = blend_premultiplied(dst, premultiply(src));
+        CHECK(channel_distance(straight, premul) <= 1,
+              "%08x over %08x: straight %08x, premultiplied %08x",
+              src, dst, straight, premul);
+    }
+}
+
+static void check_texture_blits(void)
+{
+    enum { W = 173, H = 131 };
+    picasso_backbuffer *a = picasso_create_backbuffer(W, H);
+    picasso_backbuffer *b = picasso_create_backbuffer(W, H);
+    picasso_image *opaque = random_image(37, 29, true);
+    picasso_image *blended = random_image(37, 29, false);
+    picasso_texture *opaque_tex = picasso_texture_from_image(opaque);
+    picasso_texture *blended_tex = picasso_texture_from_image(blended);
+    CHECK(a && b && opaque_tex && blended_tex, "out of memory");
+
+    for (int round = 0; round < 2000; round++) {
+        picasso_rect src = { rng_range(37), rng_range(29), 1 + rng_range(37), 1 + rng_range(29) };
+        picasso_rect dst = { rng_range(W + 40) - 20, rng_range(H + 40) - 20,
+                             1 + rng_range(120), 1 + rng_range(120) };
+        fill_random(a);
+        memcpy(b->pixels, a->pixels, (size_t)W * H * sizeof(uint32_t));
+
+        picasso_blit_rect(a, opaque, src, dst);
+        picasso_blit_texture(b, opaque_tex, src, dst);
+        CHECK(same_pixels(a, b), "opaque blit %d,%d %dx%d -> %d,%d %dx%d differs",
+              src.x, src.y, src.width, src.height, dst.x, dst.y, dst.width, dst.height);
+
+        picasso_blit_rect(a, blended, src, dst);
+        picasso_blit_texture(b, blended_tex, src, dst);
+        for (int i = 0; i < W * H; i++)
+            CHECK(channel_distance(a->pixels[i], b->pixels[i]) <= 1,
+                  "translucent blit pixel %d: %08x against %08x", i,
+                  b->pixels[i], a->pixels[i]);
+        memcpy(b->pixels, a->pixels, (size_t)W * H * sizeof(uint32_t));
+    }
+
+    picasso_free_texture(opaque_tex);
+    picasso_free_texture(blended_tex);
+    picasso_free_image(opaque);
+    picasso_free_image(blended);
+    picasso_destroy_backbuffer(a);
+    picasso_destroy_backbuffer(b);
+}
+
+static void check_sprite_batches(void)
+{
+    enum { W = 211, H = 177, MAX_SPRITES = 64 };
+    picasso_backbuffer *a = picasso_create_backbuffer(W, H);
+    picasso_backbuffer *b = picasso_create_backbuffer(W, H);
+    picasso_texture *atlas[2] = { NULL, NULL };
+    for (int i = 0; i < 2; i++) {
+        picasso_image *img = random_image(64, 48, i == 0);
+        atlas[i] = picasso_texture_from_image(img);
+        picasso_free_image(img);
+    }
+    CHECK(a && b && atlas[0] && atlas[1], "out of memory");
+
+    picasso_sprite sprites[MAX_SPRITES];
+    for (int round = 0; round < 2000; round++) {
+        const picasso_texture *tex = atlas[rng_range(2)];
+        int sw = 1 + rng_range(24), sh = 1 + rng_range(24);
+        picasso_sprite_batch batch = {
+            .atlas      = tex,
+            .src_width  = sw, .src_height = sh,
+            .dst_width  = 1 + rng_range(48), .dst_height = 1 + rng_range(48),
+            .offset_x   = rng_range(21) - 10, .offset_y = rng_range(21) - 10,
+            .sprites    = sprites,
+            .count      = 1 + rng_range(MAX_SPRITES),
+        };
+
+        // Rows of tiles like the game draws, with strays and atlas overruns
+        for (int i = 0; i < batch.count; i++) {
+            bool tiled = rng_range(4) != 0;
+            sprites[i] = (picasso_sprite){
+                .src_x = rng_range(64 - sw + 4), .src_y = rng_range(48 - sh + 4),
+                .dst_x = tiled ? (i % 8) * batch.dst_width : rng_range(W + 40) - 20,
+                .dst_y = tiled ? (i / 8) * batch.dst_height : rng_range(H + 40) - 20,
+            };
+        }
+
+        fill_random(a);
+        memcpy(b->pixels, a->pixels, (size_t)W * H * sizeof(uint32_t));
+
+        for (int i = 0; i < batch.count; i++) {
+            picasso_blit_texture(a, tex,
+                (picasso_rect){ sprites[i].src_x, sprites[i].src_y, sw, sh },
+                (picasso_rect){ sprites[i].dst_x + batch.offset_x,
+                                sprites[i].dst_y + batch.offset_y,
+                                batch.dst_width, batch.dst_height });
+        }
+        picasso_blit_batch(b, &batch);
+        CHECK(same_pixels(a, b), "batch of %d %dx%d sprites differs", batch.count,
+              batch.dst_width, batch.dst_height);
+    }
+
+    picasso_free_texture(atlas[0]);
+    picasso_free_texture(atlas[1]);
+    picasso_destroy_backbuffer(a);
+    picasso_destroy_backbuffer(b);
+}
+
+/* Lists large enough that the pool wakes up, PICASSO_RASTER_MIN_PIXELS */
+static void check_rasterizer(void)
+{
+    enum { W = 640, H = 480, SPRITES = 96 };
+    picasso_backbuffer *direct = picasso_create_backbuffer(W, H);
+    picasso_backbuffer *single = picasso_create_backbuffer(W, H);
+    picasso_backbuffer *multi  = picasso_create_backbuffer(W, H);
+    picasso_backbuffer *layer  = picasso_create_layer(W, H);
+    picasso_rasterizer *one    = picasso_create_rasterizer(1);
+    picasso_rasterizer *many   = picasso_create_rasterizer(4);
+    picasso_command_list *list = picasso_create_command_list();
+    picasso_image *img         = random_image(48, 40, false);
+    picasso_texture *tex       = picasso_texture_from_image(img);
+    CHECK(direct && single && multi && layer && one && many && list && tex,
+          "out of memory");
+    fill_random(layer);
+
+    picasso_sprite sprites[SPRITES];
+    for (int round = 0; round < 50; round++) {
+        picasso_reset_command_list(list);
+        picasso_clear_backbuffer(direct);
+        picasso_cmd_clear(list);
+
+        picasso_rect r = random_rect(W, H);
+        picasso_draw_layer_rect(direct, layer, r);
+        picasso_cmd_draw_layer_rect(list, layer, r);
+
+        for (int i = 0; i < 40; i++) {
+            color c = random_color();
+            picasso_rect box = random_rect(W, H);
+            int x = rng_range(W), y = rng_range(H), radius = rng_range(90);
+            int thickness = 1 + rng_range(6);
+            picasso_rect src = { rng_range(48), rng_range(40), 1 + rng_range(48), 1 + rng_range(40) };
+
+            switch (rng_range(5)) {
+                case 0:
+                    box.width *= 4; box.height *= 3;
+                    picasso_cmd_fill_rect(list, box, c);
+                    picasso_fill_rect(direct, &box, c);
+                    break;
+                case 1:
+                    picasso_cmd_draw_rect(list, box, thickness, c);
+                    picasso_draw_rect(direct, &box, thickness, c);
+                    break;
+                case 2:
+                    picasso_cmd_fill_circle(list, x, y, radius, c);
+                    picasso_fill_circle(direct, x, y, radius, c);
+                    break;
+                case 3:
+                    picasso_cmd_draw_circle(list, x, y, radius, thickness, c);
+                    picasso_draw_circle(direct, x, y, radius, thickness, c);
+                    break;
+                default:
+                    picasso_cmd_blit_texture(list, tex, src, box);
+                    picasso_blit_texture(direct, tex, src, box);
+                    break;
+            }
+        }
+
+        for (int i = 0; i < SPRITES; i++)
+            sprites[i] = (picasso_sprite){ rng_range(32), rng_range(24),
+                                           (i % 12) * 40, (i / 12) * 40 };
+        picasso_sprite_batch batch = { tex, 16, 16, 40, 40, rng_range(40), rng_range(40),
+                                       sprites, SPRITES };
+        picasso_cmd_blit_batch(list, &batch);
+        picasso_blit_batch(direct, &batch);
+
+        picasso_rasterize(one, single, list);
+        picasso_rasterize(many, multi, list);
+        CHECK(same_pixels(single, multi), "round %d: 1 and 4 workers differ", round);
+        CHECK(same_pixels(direct, multi), "round %d: rasterized and direct differ", round);
+    }
+
+    picasso_free_texture(tex);
+    picasso_free_image(img);
+    picasso_destroy_command_list(list);
+    picasso_destroy_rasterizer(one);
+    picasso_destroy_rasterizer(many);
+    picasso_destroy_backbuffer(direct);
+    picasso_destroy_backbuffer(single);
+    picasso_destroy_backbuffer(multi);
+    picasso_destroy_backbuffer(layer);
+}
+
+int main(void)
+{
+    struct { const char *name; void (*run)(void); } checks[] = {
+        { "blend spans",            check_blend_spans },
+        { "premultiplied rounding", check_premultiplied_rounding },
+        { "texture blits",          check_texture_blits },
+        { "sprite batches",         check_sprite_batches },
+        { "rasterizer",             check_rasterizer },
+    };
+
+    for (size_t i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+        int before = failures;
+        checks[i].run();
+        printf("%-24s %s\n", checks[i].name, failures == before ? "ok" : "FAILED");
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}